@@ -4,17 +4,84 @@
 #include "../src/Params.h"
 #include "../src/Voice.h"
 
-static void doStepLoop(benchmark::State& state, AllParams& p) {
-    juce::AudioBuffer<float> buffer{2, 0};
+//==============================================================================
+// ベンチマーク用の音色。鳴らさない倍音とノイズはミュートする (ミュートしたものは計算されない)
+struct Patch {
+    const char* name;
+    int numHarmonics;  // 低い方から鳴らす倍音の数 (NUM_OSC なら最後のノコギリ波の高次倍音まで鳴らす)
+    int numNoises;
+    int numFilters;  // ノイズ 1 つあたりの有効なフィルターの数
+    FILTER_TYPE filterType;
+    FILTER_FREQ_TYPE freqType;
+    bool delay;
+};
+const Patch PATCHES[] = {
+    {"single_sine", 1, 0, 0, FILTER_TYPE::Lowpass, FILTER_FREQ_TYPE::Absolute, false},
+    {"multiple_sine", NUM_OSC - 1, 0, 0, FILTER_TYPE::Lowpass, FILTER_FREQ_TYPE::Absolute, false},
+    {"all_harmonics", NUM_OSC, 0, 0, FILTER_TYPE::Lowpass, FILTER_FREQ_TYPE::Absolute, false},
+    {"single_abs_filter", 1, 1, 1, FILTER_TYPE::Lowpass, FILTER_FREQ_TYPE::Absolute, false},
+    {"multiple_abs_filter",
+     NUM_OSC,
+     NUM_NOISE,
+     NUM_NOISE_FILTER,
+     FILTER_TYPE::Peaking,
+     FILTER_FREQ_TYPE::Absolute,
+     false},
+    {"multiple_rel_filter",
+     NUM_OSC,
+     NUM_NOISE,
+     NUM_NOISE_FILTER,
+     FILTER_TYPE::Bandpass1,
+     FILTER_FREQ_TYPE::Relative,
+     false},
+    {"full", NUM_OSC, NUM_NOISE, NUM_NOISE_FILTER, FILTER_TYPE::Peaking, FILTER_FREQ_TYPE::Relative, true},
+};
+const int NUM_PATCHES = sizeof(PATCHES) / sizeof(Patch);
+
+// 全音色で同じ設定にする。途中で止まって鳴らし直しにならないようにディケイは最大にしておく
+static void applyPatch(AllParams& p, const Patch& patch) {
+    for (auto& mainParams : p.mainParams) {
+        for (int i = 0; i < NUM_OSC; ++i) {
+            *mainParams.envelopeParams[i].Decay = 2.0f;
+        }
+        for (int i = 0; i < NUM_NOISE; ++i) {
+            *mainParams.noiseEnvelopeParams[i].Decay = 2.0f;
+        }
+    }
+    for (int i = patch.numHarmonics; i < NUM_OSC; ++i) {
+        p.soloMuteParams.turnOnMute(false, i);
+    }
+    for (int i = patch.numNoises; i < NUM_NOISE; ++i) {
+        p.soloMuteParams.turnOnMute(true, i);
+    }
+    for (auto& noiseUnitParams : p.noiseUnitParams) {
+        for (int i = 0; i < NUM_NOISE_FILTER; ++i) {
+            auto& fp = noiseUnitParams.filterParams[i];
+            *fp.Enabled = i < patch.numFilters;
+            *fp.Type = static_cast<int>(patch.filterType);
+            *fp.FreqType = static_cast<int>(patch.freqType);
+            *fp.Semitone = 12 * (i + 1);
+        }
+    }
+    *p.delayParams.Enabled = patch.delay;
+    p.freeze();
+}
+
+// state.range(0): PATCHES の番号
+// state.range(1): renderBlock() に渡すブロックのサイズ
+static void BM_VoiceStep(benchmark::State& state) {
+    auto& patch = PATCHES[state.range(0)];
+    auto blockSize = (int)state.range(1);
+    AllParams p{};
+    applyPatch(p, patch);
+    juce::AudioBuffer<float> buffer{2, blockSize};
 
     BerryVoice voice{buffer, p};
     auto numChannels = 2;
     auto sampleRate = 48000;
-    double out[2]{0, 0};
 
     BerrySound sound = BerrySound();
 
-    p.freeze();
     int noteNumber = 60;
     voice.startNote(noteNumber, 1.0, &sound, 8192);
     auto calculatedParams = CalculatedParams{};
@@ -22,52 +89,364 @@ static void doStepLoop(benchmark::State& state, AllParams& p) {
     p.calculateIntermediateParams(calculatedParams, calculatedNoiseParams, noteNumber);
     voice.applyParamsBeforeLoop(sampleRate, calculatedParams, calculatedNoiseParams);
     for (auto _ : state) {
-        voice.step(out, sampleRate, numChannels, calculatedParams, calculatedNoiseParams);
+        buffer.clear();
+        auto active =
+            voice.renderBlock(buffer, 0, blockSize, sampleRate, numChannels, calculatedParams, calculatedNoiseParams);
+        if (!active) {
+            // 減衰しきったボイスを測っても意味がないので鳴らし直す
+            state.PauseTiming();
+            voice.startNote(noteNumber, 1.0, &sound, 8192);
+            state.ResumeTiming();
+        }
     }
+    state.SetItemsProcessed(state.iterations() * blockSize);
+    state.SetLabel(patch.name);
 }
+BENCHMARK(BM_VoiceStep)->ArgsProduct({benchmark::CreateDenseRange(0, NUM_PATCHES - 1, 1), {64, 512}});
 
-static void BM_VoiceStep_empty(benchmark::State& state) {
-    AllParams p{};
-    doStepLoop(state, p);
+// BerrySynthesiser::renderNextBlock で numVoices 個のボイスを鳴らし続ける (減衰しきったら鳴らし直す)
+static void doSynthLoop(benchmark::State& state, AllParams& p, int numThreads, int numVoices, int blockSize) {
+    auto sampleRate = 48000;
+    juce::AudioBuffer<float> buffer{2, 0};
+    MonoStack monoStack;
+    BerrySynthesiser synth(monoStack, buffer, p);
+    for (int i = 0; i < MAX_VOICES; ++i) {
+        auto* voice = new BerryVoice(buffer, p);
+        voice->setNoiseSeed(i);
+        synth.addVoice(voice);
+    }
+    synth.setCurrentPlaybackSampleRate(sampleRate);
+    synth.prepareParallelRendering(numThreads, blockSize);
+
+    juce::AudioBuffer<float> out{2, blockSize};
+    juce::MidiBuffer noMidi;
+    auto countActiveVoices = [&] {
+        int count = 0;
+        for (int i = 0; i < synth.getNumVoices(); ++i) {
+            count += synth.getVoice(i)->isVoiceActive() ? 1 : 0;
+        }
+        return count;
+    };
+    for (auto _ : state) {
+        if (countActiveVoices() < numVoices) {
+            state.PauseTiming();
+            synth.allNotesOff(0, false);
+            juce::MidiBuffer midi;
+            for (int i = 0; i < numVoices; ++i) {
+                midi.addEvent(juce::MidiMessage::noteOn(1, 36 + i, 1.0f), 0);
+            }
+            out.clear();
+            synth.renderNextBlock(out, midi, 0, blockSize);
+            state.ResumeTiming();
+        }
+        out.clear();
+        synth.renderNextBlock(out, noMidi, 0, blockSize);
+        benchmark::DoNotOptimize(out.getReadPointer(0));
+    }
+    state.SetItemsProcessed(state.iterations() * blockSize);
+    // 1 コアで実時間に間に合うボイスの数 (numThreads == 0 のときだけ意味がある)
+    state.counters["voices_per_core"] = benchmark::Counter(
+        (double)state.iterations() * blockSize * numVoices / sampleRate, benchmark::Counter::kIsRate);
 }
-BENCHMARK(BM_VoiceStep_empty);
 
-static void BM_VoiceStep_single_sine(benchmark::State& state) {
+// state.range(0): PATCHES の番号, state.range(1): 同時に鳴らすボイスの数, state.range(2): ブロックサイズ
+static void BM_Synth(benchmark::State& state) {
+    auto& patch = PATCHES[state.range(0)];
     AllParams p{};
-    doStepLoop(state, p);
+    applyPatch(p, patch);
+    doSynthLoop(state, p, 0, (int)state.range(1), (int)state.range(2));
+    state.SetLabel(patch.name);
 }
-BENCHMARK(BM_VoiceStep_single_sine);
+BENCHMARK(BM_Synth)->ArgsProduct(
+    {benchmark::CreateDenseRange(0, NUM_PATCHES - 1, 1), {1, 8, 32, 64}, {32, 128, 512}});
 
-static void BM_VoiceStep_multiple_sine(benchmark::State& state) {
-    AllParams p{};
-    doStepLoop(state, p);
+// 15 倍音 (261.6Hz * 15) を 10 秒鳴らした時の、正確な位相から計算した std::sin との最大誤差
+template <typename F>
+static double measureMaxError(F&& nextValue) {
+    auto sampleRate = 48000.0;
+    auto delta = 261.6 * 15 / sampleRate;
+    double maxError = 0.0;
+    for (int i = 0; i < sampleRate * 10; ++i) {
+        auto expected = std::sin(TWO_PI * std::fmod((i + 1) * delta, 1.0));
+        maxError = std::max(maxError, std::abs(nextValue() - expected));
+    }
+    return maxError;
 }
-BENCHMARK(BM_VoiceStep_multiple_sine);
 
-static void BM_VoiceStep_single_abs_filter(benchmark::State& state) {
-    AllParams p{};
-    doStepLoop(state, p);
+template <typename Sample>
+static void BM_Harmonics_multiOsc(benchmark::State& state) {
+    auto sampleRate = 48000;
+    MultiOsc<Sample> oscs[NUM_OSC - 1]{MultiOsc<Sample>(false),
+                                       MultiOsc<Sample>(false),
+                                       MultiOsc<Sample>(false),
+                                       MultiOsc<Sample>(false),
+                                       MultiOsc<Sample>(false),
+                                       MultiOsc<Sample>(false),
+                                       MultiOsc<Sample>(false),
+                                       MultiOsc<Sample>(false),
+                                       MultiOsc<Sample>(false),
+                                       MultiOsc<Sample>(false),
+                                       MultiOsc<Sample>(false),
+                                       MultiOsc<Sample>(false),
+                                       MultiOsc<Sample>(false),
+                                       MultiOsc<Sample>(false),
+                                       MultiOsc<Sample>(false)};
+    for (auto& osc : oscs) {
+        osc.setSampleRate(sampleRate);
+    }
+    double freqs[64];
+    std::fill_n(freqs, 64, 261.6);
+    Sample outL[64]{};
+    Sample outR[64]{};
+    for (auto _ : state) {
+        for (int i = 0; i < NUM_OSC - 1; ++i) {
+            oscs[i].addBlock(0.0, freqs, i + 1.0, 0.1, 0.1, outL, outR, 64);
+        }
+        benchmark::DoNotOptimize(outL);
+    }
+    state.SetItemsProcessed(state.iterations() * 64);
+
+    Osc<Sample> osc;
+    osc.setWaveform(WAVEFORM::Sine);
+    osc.setSampleRate(sampleRate);
+    state.counters["max_error"] = measureMaxError([&] { return (double)osc.step(261.6 * 15, 0.0); });
 }
-BENCHMARK(BM_VoiceStep_single_abs_filter);
+BENCHMARK_TEMPLATE(BM_Harmonics_multiOsc, float);
+BENCHMARK_TEMPLATE(BM_Harmonics_multiOsc, double);
 
-static void BM_VoiceStep_multiple_abs_filter(benchmark::State& state) {
-    AllParams p{};
-    doStepLoop(state, p);
+static void BM_Harmonics_wavetable(benchmark::State& state) {
+    auto sampleRate = 48000.0;
+    juce::SharedResourcePointer<WavetableStore> wavetables;
+    auto& sine = wavetables->getSine();
+    WavetableOsc oscs[NUM_OSC - 1]{WavetableOsc(sine),
+                                   WavetableOsc(sine),
+                                   WavetableOsc(sine),
+                                   WavetableOsc(sine),
+                                   WavetableOsc(sine),
+                                   WavetableOsc(sine),
+                                   WavetableOsc(sine),
+                                   WavetableOsc(sine),
+                                   WavetableOsc(sine),
+                                   WavetableOsc(sine),
+                                   WavetableOsc(sine),
+                                   WavetableOsc(sine),
+                                   WavetableOsc(sine),
+                                   WavetableOsc(sine),
+                                   WavetableOsc(sine)};
+    for (auto& osc : oscs) {
+        osc.setSampleRate(sampleRate);
+    }
+    double freqs[64];
+    std::fill_n(freqs, 64, 261.6);
+    double outL[64]{};
+    double outR[64]{};
+    for (auto _ : state) {
+        for (int k = 0; k < NUM_OSC - 1; ++k) {
+            oscs[k].addBlock(freqs, k + 1.0, 0.1, 0.1, 0.1, 0.1, outL, outR, 64);
+        }
+        benchmark::DoNotOptimize(outL);
+        benchmark::DoNotOptimize(outR);
+    }
+    state.SetItemsProcessed(state.iterations() * 64);
+
+    WavetableOsc osc(sine);
+    osc.setSampleRate(sampleRate);
+    state.counters["max_error"] = measureMaxError([&] { return osc.step(261.6 * 15); });
+}
+BENCHMARK(BM_Harmonics_wavetable);
+
+// ミップマップした WavetableOsc で高次倍音 (ノコギリ波の 16 倍音以上) を鳴らす (ボイスと同じ VoiceSample に書く)。
+// addBlock は 8 サンプルずつまとめて計算するが、表を引くところと位相の累積はレーンごとのまま
+static void BM_SawWavetable(benchmark::State& state) {
+    auto sampleRate = 48000;
+    juce::SharedResourcePointer<WavetableStore> wavetables;
+    WavetableOsc wavetableOsc(wavetables->getSawHigh());
+    wavetableOsc.setSampleRate(sampleRate);
+    double freqs[64];
+    std::fill_n(freqs, 64, 261.6);
+    VoiceSample outL[64]{};
+    VoiceSample outR[64]{};
+    for (auto _ : state) {
+        wavetableOsc.addBlock(freqs, 1.0, 0.1, 0.1, 0.1, 0.1, outL, outR, 64);
+        benchmark::DoNotOptimize(outL);
+        benchmark::DoNotOptimize(outR);
+    }
+    state.SetItemsProcessed(state.iterations() * 64);
+}
+BENCHMARK(BM_SawWavetable);
+
+// state.range(0): HARMONIC_ENGINE, state.range(1): coherent, state.range(2): 周波数を動かすか (グライドやピッチベンド)
+static void BM_Harmonics_bank(benchmark::State& state) {
+    auto sampleRate = 48000;
+    auto engine = static_cast<HARMONIC_ENGINE>(state.range(0));
+    auto coherent = state.range(1) != 0;
+    auto swept = state.range(2) != 0;
+    HarmonicBank bank;
+    bank.setSampleRate(sampleRate);
+    bank.setEngine(engine);
+    bank.setCoherent(coherent);
+    for (int i = 0; i < NUM_OSC - 1; ++i) {
+        bank.setGain(i, 0.1);
+    }
+    // ボイスと同じく CONTROL_INTERVAL サンプルの区間ごとに呼ぶ。動かすときは区間の中で線形に上げる
+    double freqs[64];
+    for (int i = 0; i < 64; ++i) {
+        freqs[i] = swept ? 261.6 + 0.5 * (i % CONTROL_INTERVAL) : 261.6;
+    }
+    double outL[64]{};
+    double outR[64]{};
+    for (auto _ : state) {
+        for (int start = 0; start < 64; start += CONTROL_INTERVAL) {
+            bank.addBlock(0.0, freqs + start, outL + start, outR + start, CONTROL_INTERVAL);
+        }
+        benchmark::DoNotOptimize(outL);
+    }
+    state.SetItemsProcessed(state.iterations() * 64);
+    state.SetLabel(std::string(engine == HARMONIC_ENGINE::Polynomial ? "polynomial" : "recursive") +
+                   (coherent ? "/coherent" : "") + (swept ? "/swept" : ""));
+
+    // 15 倍音だけを一定の周波数で鳴らして 1 サンプルずつ取り出す (ブロックの区切りは CONTROL_INTERVAL と同じにする)
+    std::fill_n(freqs, 64, 261.6);
+    HarmonicBank single;
+    single.setSampleRate(sampleRate);
+    single.setEngine(engine);
+    single.setCoherent(coherent);
+    single.setGain(14, 1.0);
+    double values[2][16]{};
+    int cursor = 16;
+    state.counters["max_error"] = measureMaxError([&] {
+        if (cursor == 16) {
+            std::fill_n(values[0], 16, 0.0);
+            single.addBlock(-1.0, freqs, values[0], values[1], 16);
+            cursor = 0;
+        }
+        return values[0][cursor++];
+    });
 }
-BENCHMARK(BM_VoiceStep_multiple_abs_filter);
+BENCHMARK(BM_Harmonics_bank)
+    ->ArgsProduct({{static_cast<int>(HARMONIC_ENGINE::Polynomial), static_cast<int>(HARMONIC_ENGINE::Recursive)},
+                   {0, 1},
+                   {0, 1}});
 
-static void BM_VoiceStep_full(benchmark::State& state) {
+// state.range(0): 鳴らす倍音の数 (全体に散らばるように選ぶ)
+static void BM_Harmonics_sparse(benchmark::State& state) {
+    auto sampleRate = 48000;
+    auto numLanes = (int)state.range(0);
+    HarmonicBank bank;
+    bank.setSampleRate(sampleRate);
+    uint32_t mask = 0;
+    for (int i = 0; i < numLanes; ++i) {
+        auto lane = i * (NUM_OSC - 1) / numLanes;
+        mask |= 1u << lane;
+        bank.setGain(lane, 0.1);
+    }
+    bank.setActiveLanes(mask);
+    double freqs[64];
+    std::fill_n(freqs, 64, 261.6);
+    double outL[64]{};
+    double outR[64]{};
+    for (auto _ : state) {
+        bank.addBlock(0.0, freqs, outL, outR, 64);
+        benchmark::DoNotOptimize(outL);
+    }
+    state.SetItemsProcessed(state.iterations() * 64);
+}
+BENCHMARK(BM_Harmonics_sparse)->Arg(1)->Arg(4)->Arg(8)->Arg(15);
+
+// state.range(0): 0 なら juce::Random で 1 サンプルずつ (従来の方法)、1 ならホワイト、2 ならピンクをブロックで作る
+static void BM_Noise(benchmark::State& state) {
+    auto mode = (int)state.range(0);
+    juce::Random random;
+    NoiseGenerator noise;
+    noise.setWaveform(mode == 2 ? WAVEFORM::Pink : WAVEFORM::White);
+    double out[64];
+    for (auto _ : state) {
+        if (mode == 0) {
+            for (int i = 0; i < 64; ++i) {
+                out[i] = random.nextDouble() * 2.0 - 1.0;
+            }
+        } else {
+            noise.fill(out, 64);
+        }
+        benchmark::DoNotOptimize(out);
+    }
+    state.SetItemsProcessed(state.iterations() * 64);
+    state.SetLabel(mode == 0 ? "juce::Random" : mode == 1 ? "white" : "pink");
+}
+BENCHMARK(BM_Noise)->Arg(0)->Arg(1)->Arg(2);
+
+// state.range(0) == 0 ならカットオフ固定、それ以外はコントロールレートごとにカットオフを動かす
+template <typename Sample>
+static void BM_Filter(benchmark::State& state) {
+    auto sampleRate = 48000;
+    auto swept = state.range(0) != 0;
+    Filter<Sample> filter;
+    filter.setSampleRate(sampleRate);
+    juce::Random whiteNoise;
+    Sample noise[2][CONTROL_INTERVAL];
+    for (int i = 0; i < CONTROL_INTERVAL; ++i) {
+        noise[0][i] = noise[1][i] = whiteNoise.nextDouble() * 2 - 1;
+    }
+    Sample l[CONTROL_INTERVAL];
+    Sample r[CONTROL_INTERVAL];
+    int counter = 0;
+    for (auto _ : state) {
+        auto freq = swept ? 200.0 + (counter++ % 1000) * 10.0 : 1000.0;
+        filter.setParams(FILTER_TYPE::Peaking, freq, 2.0, 6.0, CONTROL_INTERVAL);
+        std::copy_n(noise[0], CONTROL_INTERVAL, l);
+        std::copy_n(noise[1], CONTROL_INTERVAL, r);
+        filter.process(l, r, CONTROL_INTERVAL);
+        benchmark::DoNotOptimize(l);
+        benchmark::DoNotOptimize(r);
+    }
+    state.SetItemsProcessed(state.iterations() * CONTROL_INTERVAL);
+    state.SetLabel(swept ? "swept" : "static");
+}
+BENCHMARK_TEMPLATE(BM_Filter, float)->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_Filter, double)->Arg(0)->Arg(1);
+
+// 1 ボイス分 (倍音 + ノイズ) のエンベロープをコントロールレートで進める。ノートオンとオフを繰り返す
+template <typename Sample>
+static void BM_Envelopes(benchmark::State& state) {
+    auto fixedSampleRate = 48000.0 * CONTROL_RATE;
+    const int numEnvelopes = NUM_OSC + NUM_NOISE;
+    EnvelopeBank<Sample, numEnvelopes> envelopes;
+    for (int i = 0; i < numEnvelopes; ++i) {
+        envelopes.setParams(i, 0.3 + i * 0.02, 0.01 * (i + 1), 0.0, 0.1 + i * 0.05, 0.0, 0.2);
+    }
+    int counter = 0;
+    for (auto _ : state) {
+        if (counter % 200 == 0) {
+            for (int i = 0; i < numEnvelopes; ++i) {
+                envelopes.doAttack(i, fixedSampleRate);
+            }
+        } else if (counter % 200 == 100) {
+            for (int i = 0; i < numEnvelopes; ++i) {
+                envelopes.doRelease(i, fixedSampleRate);
+            }
+        }
+        counter++;
+        envelopes.step(fixedSampleRate);
+        benchmark::DoNotOptimize(envelopes.getValue(0));
+    }
+    state.SetItemsProcessed(state.iterations() * numEnvelopes);
+}
+BENCHMARK_TEMPLATE(BM_Envelopes, float);
+BENCHMARK_TEMPLATE(BM_Envelopes, double);
+
+// state.range(0): ワーカースレッドの数, state.range(1): 同時に鳴らすボイスの数
+static void BM_RenderVoices(benchmark::State& state) {
     AllParams p{};
-    *p.delayParams.Enabled = true;
-    doStepLoop(state, p);
+    doSynthLoop(state, p, (int)state.range(0), (int)state.range(1), 256);
 }
-BENCHMARK(BM_VoiceStep_full);
+BENCHMARK(BM_RenderVoices)->ArgsProduct({{0, 1, 3}, {8, 32, 64}})->UseRealTime();
 
 static void BM_DelayStep(benchmark::State& state) {
     auto numChannels = 2;
     auto sampleRate = 48000;
-    StereoDelay stereoDelay{};
+    StereoDelay<VoiceSample> stereoDelay{};
 
+    stereoDelay.prepare(sampleRate, MAX_DELAY_TIME);
     stereoDelay.setParams(sampleRate,
                           DELAY_TYPE::Parallel,
                           0.3,   // TimeL
@@ -79,10 +458,50 @@ static void BM_DelayStep(benchmark::State& state) {
     juce::Random whiteNoise;
     for (auto _ : state) {
         double s = whiteNoise.nextDouble();
-        double sample[2]{s, s};
+        VoiceSample sample[2]{(VoiceSample)s, (VoiceSample)s};
         stereoDelay.step(sample);
     }
+    state.SetItemsProcessed(state.iterations());
 }
 BENCHMARK(BM_DelayStep);
 
+// state.range(0): ブロックの長さ, state.range(1) != 0 ならブロックごとに遅延時間を揺らす
+template <typename Sample>
+static void BM_DelayBlock(benchmark::State& state) {
+    auto blockSize = (int)state.range(0);
+    auto modulated = state.range(1) != 0;
+    auto sampleRate = 48000;
+    StereoDelay<Sample> stereoDelay{};
+    stereoDelay.prepare(sampleRate, MAX_DELAY_TIME);
+
+    juce::Random whiteNoise;
+    std::vector<Sample> noise(blockSize);
+    for (auto& s : noise) {
+        s = whiteNoise.nextDouble();
+    }
+    std::vector<Sample> l(blockSize);
+    std::vector<Sample> r(blockSize);
+    int counter = 0;
+    for (auto _ : state) {
+        auto timeL = modulated ? 0.3 + 0.005 * std::sin(counter++ * 0.01) : 0.3;
+        stereoDelay.setParams(sampleRate,
+                              DELAY_TYPE::Parallel,
+                              timeL,  // TimeL
+                              0.3,    // TimeR
+                              100,    // LowFreq
+                              4000,   // HighFreq
+                              0.3,    // Feedback
+                              0.3);   // Mix
+        std::copy(noise.begin(), noise.end(), l.begin());
+        std::copy(noise.begin(), noise.end(), r.begin());
+        stereoDelay.process(l.data(), r.data(), blockSize);
+        benchmark::DoNotOptimize(l.data());
+        benchmark::DoNotOptimize(r.data());
+    }
+    state.SetItemsProcessed(state.iterations() * blockSize);
+    state.SetLabel(modulated ? "modulated" : "static");
+}
+BENCHMARK_TEMPLATE(BM_DelayBlock, float)->ArgsProduct({{16, 64, 256}, {0, 1}});
+BENCHMARK_TEMPLATE(BM_DelayBlock, double)->ArgsProduct({{16, 64, 256}, {0, 1}});
+
 BENCHMARK_MAIN();
\ No newline at end of file
@@ -1,86 +1,227 @@
+#include <algorithm>
+#include <atomic>
 #include <cmath>
-#include <filesystem>
+#include <complex>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/Fft.h"
+#include "../src/Wavetable.h"
+
+// プラグインの WavetableStore が読むキャッシュと同じ形式でウェーブテーブルを書き出す。
+// 形式、波形の定義、ハッシュはプラグインと同じもの (src/Wavetable.h) を使う。
+// プラグインがそのまま読めるのは、既定の設定 (--size 4096 --waveforms saw-high,sine) で作ったものだけ
+// (それ以外はヘッダの波形の番号かハッシュが合わないので、プラグインは読まずに自分で作り直す)。
 
 namespace {
-const int NUM_DIVISIONS = 4095;
-const int NUM_SAMPLES = NUM_DIVISIONS + 1;
-const int MIN_PARTIAL = 16;  // 第{MIN_PARTIAL}倍音以降のみ足し合わせる
-const float BASE_FREQ = 440.0f;
-const float MAX_FREQ = 22000.0f;
-const float PI = 3.141592f;
-const std::string LOOKUP_FILE = "lookup";
-const std::string SINE_FILE = "sine";
-const std::string SAW_FILE = "saw";
-}  // namespace
+struct Options {
+    int tableBits = 12;
+    int levelsPerOctave = wavetable::DEFAULT_LEVELS_PER_OCTAVE;
+    std::vector<std::string> waveforms{"saw-high", "sine"};
+    int numThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+    std::string output = "wavetables.cache";
+};
 
-int main() {
-    {
-        std::cout << "generating lookup table..." << std::endl;
-        int* lookupTable = new int[22000]();
-        int freqIndex = 0;
-        for (int noteNum = 0; noteNum < 128; noteNum++) {
-            float freq = BASE_FREQ * std::pow(2.0, ((float)noteNum - 69) / 12);
-            while (freqIndex < freq) {
-                lookupTable[freqIndex] = noteNum;
-                freqIndex++;
-            }
+bool findWaveform(const std::string &name, wavetable::Waveform &waveform) {
+    using wavetable::WAVEFORM_ID;
+    if (name == "saw-high") {
+        waveform = wavetable::getWaveform(WAVEFORM_ID::SawHigh);
+    } else if (name == "saw") {
+        waveform = wavetable::getWaveform(WAVEFORM_ID::Saw);
+    } else if (name == "square") {
+        waveform = wavetable::getWaveform(WAVEFORM_ID::Square);
+    } else if (name == "triangle") {
+        waveform = wavetable::getWaveform(WAVEFORM_ID::Triangle);
+    } else if (name == "sine") {
+        waveform = wavetable::getWaveform(WAVEFORM_ID::Sine);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::vector<std::string> split(const std::string &s, char separator) {
+    std::vector<std::string> items;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, separator)) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+void printUsage() {
+    std::cout << "usage: wavetable-gen [options]\n"
+                 "  --size N                 samples per table, power of two (default 4096)\n"
+                 "  --levels-per-octave K    mip levels per octave (default 2)\n"
+                 "  --waveforms a,b,...      saw-high, saw, square, triangle, sine (default saw-high,sine)\n"
+                 "  --threads T              worker threads (default: number of cores)\n"
+                 "  --out FILE               output file (default wavetables.cache)\n";
+}
+
+bool parseOptions(int argc, char **argv, Options &options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            return false;
         }
-        int lastFreqIndex = freqIndex - 1;
-        while (freqIndex < 22000) {
-            lookupTable[freqIndex] = lookupTable[lastFreqIndex];
-            freqIndex++;
+        if (i + 1 >= argc) {
+            std::cerr << "missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--size") {
+            auto size = std::stoi(value);
+            if (size < 4 || (size & (size - 1)) != 0) {
+                std::cerr << "--size must be a power of two" << std::endl;
+                return false;
+            }
+            options.tableBits = 0;
+            while ((1 << options.tableBits) < size) {
+                options.tableBits++;
+            }
+        } else if (arg == "--levels-per-octave") {
+            options.levelsPerOctave = std::max(1, std::stoi(value));
+        } else if (arg == "--waveforms") {
+            options.waveforms = split(value, ',');
+        } else if (arg == "--threads") {
+            options.numThreads = std::max(1, std::stoi(value));
+        } else if (arg == "--out") {
+            options.output = value;
+        } else {
+            std::cerr << "unknown option " << arg << std::endl;
+            return false;
         }
-        std::ofstream ofs(LOOKUP_FILE, std::ios::out | std::ios::binary);
-        ofs.write(reinterpret_cast<const char*>(lookupTable), 22000 * sizeof(int));
-        delete[] lookupTable;
     }
-    {
-        std::cout << "generating sine table..." << std::endl;
-        float* sineTable = new float[NUM_SAMPLES]();
+    return true;
+}
+
+// 1 つの波形の全段。段ごとのテーブルは独立に作れるので、全波形の全段をまとめてスレッドに配る
+struct Bank {
+    wavetable::Waveform waveform;
+    int levelsPerOctave;
+    std::vector<int32_t> maxHarmonics;
+    std::vector<float> tables;
+};
 
-        for (int i = 0; i < NUM_SAMPLES; i++) {
-            float angle = 2.0 * PI / NUM_DIVISIONS * i;
-            float value = std::sin(angle);
-            sineTable[i] = value;
+void buildTable(const Options &options, Bank &bank, int level) {
+    auto size = 1 << options.tableBits;
+    auto maxHarmonic = bank.maxHarmonics[level];
+    std::vector<std::complex<double>> data(size);
+    for (int h = 1; h <= maxHarmonic; ++h) {
+        auto c = bank.waveform.spectrum(h, maxHarmonic);
+        data[h] = c;
+        data[size - h] = std::conj(c);
+    }
+    fft::transform(data, true);
+    auto *table = &bank.tables[(size_t)level * (size + 1)];
+    for (int i = 0; i < size; ++i) {
+        table[i] = (float)data[i].real();
+    }
+    table[size] = table[0];
+}
+
+// 最も豊かな段のピークが 1 になるように正規化する
+void normalize(const Options &options, Bank &bank) {
+    auto size = 1 << options.tableBits;
+    float peak = 0.0f;
+    for (int i = 0; i < size; ++i) {
+        peak = std::max(peak, std::abs(bank.tables[i]));
+    }
+    if (peak == 0.0f) {
+        return;
+    }
+    auto scale = 1.0f / peak;
+    for (int level = 0; level < (int)bank.maxHarmonics.size(); ++level) {
+        auto *table = &bank.tables[(size_t)level * (size + 1)];
+        for (int i = 0; i < size; ++i) {
+            table[i] *= scale;
         }
+        table[size] = table[0];
+    }
+}
+}  // namespace
 
-        std::ofstream ofs(SINE_FILE, std::ios::out | std::ios::binary);
-        ofs.write(reinterpret_cast<const char*>(sineTable), NUM_SAMPLES * sizeof(float));
-        delete[] sineTable;
-    }
-    {
-        std::cout << "generating saw table..." << std::endl;
-        float* sawTable = new float[128 * NUM_SAMPLES]();
-        for (int noteNum = 0; noteNum < 128; noteNum++) {
-            float freq = BASE_FREQ * std::pow(2.0, ((float)noteNum - 69) / 12);
-            for (int i = 0; i < NUM_SAMPLES; i++) {
-                float angle = 2.0 * PI / NUM_DIVISIONS * i;
-                float value = 0.0f;
-                int numPartials = MAX_FREQ / freq;
-                for (int n = MIN_PARTIAL; n <= numPartials; n++) {
-                    float k = (PI / 2) / numPartials;
-                    float gibbsFix = std::pow(std::cos((n - 1) * k), 2);
-                    value += std::sin(n * angle) / n * gibbsFix;
-                }
-                sawTable[noteNum * NUM_SAMPLES + i] = value;
-            }
+int main(int argc, char **argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+    auto size = 1 << options.tableBits;
+
+    std::vector<Bank> banks;
+    for (auto &name : options.waveforms) {
+        Bank bank;
+        if (!findWaveform(name, bank.waveform)) {
+            std::cerr << "unknown waveform " << name << std::endl;
+            printUsage();
+            return 1;
         }
-        float max = 0.0f;
-        // normalize to richest waveform(0)
-        for (int i = 0; i < NUM_SAMPLES; i++) {
-            max = std::max(std::abs(sawTable[i]), max);
+        bank.levelsPerOctave =
+            bank.waveform.levelsPerOctave > 0 ? bank.waveform.levelsPerOctave : options.levelsPerOctave;
+        auto highest = bank.waveform.highestHarmonic > 0 ? bank.waveform.highestHarmonic : size / 2 - 1;
+        bank.maxHarmonics =
+            wavetable::getMaxHarmonics(bank.levelsPerOctave, bank.waveform.lowestHarmonic, highest);
+        bank.tables.assign(bank.maxHarmonics.size() * (size + 1), 0.0f);
+        std::cout << name << ": " << bank.maxHarmonics.size() << " levels" << std::endl;
+        banks.push_back(std::move(bank));
+    }
+
+    std::vector<std::pair<int, int>> tasks;  // (bank, level)
+    for (int b = 0; b < (int)banks.size(); ++b) {
+        for (int level = 0; level < (int)banks[b].maxHarmonics.size(); ++level) {
+            tasks.emplace_back(b, level);
         }
-        //        std::cout << "max=" << max << std::endl;
-        for (int i = 0; i < 128 * NUM_SAMPLES; i++) {
-            sawTable[i] = sawTable[i] / max;
+    }
+    std::atomic<int> next{0};
+    auto work = [&] {
+        for (int i = next++; i < (int)tasks.size(); i = next++) {
+            buildTable(options, banks[tasks[i].first], tasks[i].second);
         }
-        std::ofstream ofs(SAW_FILE, std::ios::out | std::ios::binary);
-        ofs.write(reinterpret_cast<const char*>(sawTable), 128 * NUM_SAMPLES * sizeof(float));
-        delete[] sawTable;
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < options.numThreads; ++i) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (auto &bank : banks) {
+        normalize(options, bank);
     }
+
+    std::ofstream ofs(options.output, std::ios::out | std::ios::binary);
+    for (auto &bank : banks) {
+        std::vector<char> body(bank.maxHarmonics.size() * sizeof(int32_t) + bank.tables.size() * sizeof(float));
+        std::memcpy(body.data(), bank.maxHarmonics.data(), bank.maxHarmonics.size() * sizeof(int32_t));
+        std::memcpy(body.data() + bank.maxHarmonics.size() * sizeof(int32_t),
+                    bank.tables.data(),
+                    bank.tables.size() * sizeof(float));
+        int32_t header[wavetable::CACHE_HEADER_SIZE]{
+            wavetable::CACHE_FORMAT_VERSION,
+            options.tableBits,
+            bank.levelsPerOctave,
+            (int32_t)bank.maxHarmonics.size(),
+            (int32_t)bank.waveform.id,
+            (int32_t)wavetable::hashSpectrum(bank.waveform.spectrum, bank.maxHarmonics),
+            (int32_t)wavetable::hashBody(body.data(), body.size())};
+        ofs.write(reinterpret_cast<const char *>(header), sizeof(header));
+        ofs.write(body.data(), body.size());
+    }
+    if (!ofs) {
+        std::cerr << "failed to write " << options.output << std::endl;
+        return 1;
+    }
+    std::cout << "wrote " << options.output << std::endl;
     return 0;
 }
-
-// ref: https://www.musicdsp.org/en/latest/Synthesis/17-bandlimited-waveform-generation.html
@@ -0,0 +1,240 @@
+#include <JuceHeader.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../src/PluginProcessor.h"
+
+// プラグインと同じ BerryAudioProcessor::processBlock で Standard MIDI File を描画して WAV に書き出す。
+// DAW 無しで perf などのプロファイラにかけたり、CI で性能を見たりするためのもの。実時間には合わせずできるだけ速く回す。
+// 最後に実時間比とブロックごとの処理時間の分布を表示する (WAV の書き出しにかかった時間は含めない)。
+// BERRY_PROFILE を 1 にしてビルドした時は、オシレーターやフィルターなどの段ごとにかかった時間も表示する
+
+namespace {
+struct Options {
+    std::string state;   // getStateInformation の形式 (またはその中身の XML)。無ければ初期値のまま
+    std::string midi;    // 必須
+    std::string output;  // 無ければ書き出さずに測るだけ
+    std::string stats;   // プロセッサの RenderTimeStats を CSV で書き出す先
+    double sampleRate = 48000.0;
+    int blockSize = 512;
+    int numThreads = 0;
+    double tail = 2.0;  // 最後の MIDI イベントの後に描画する秒数
+    int bitDepth = 24;
+};
+
+void printUsage() {
+    std::cout << "usage: berry-render --midi FILE [options]\n"
+                 "  --midi FILE          Standard MIDI File to render\n"
+                 "  --state FILE         plugin state (getStateInformation format or plain XML)\n"
+                 "  --out FILE           output WAV file (default: render without writing)\n"
+                 "  --stats FILE         write the processor's render-time histogram (and stage times) as CSV\n"
+                 "  --sample-rate HZ     sample rate (default 48000)\n"
+                 "  --block-size N       samples per processBlock call (default 512)\n"
+                 "  --threads T          voice render threads, 0 renders on the calling thread (default 0)\n"
+                 "  --tail SECONDS       time rendered after the last MIDI event (default 2)\n"
+                 "  --bits N             WAV bit depth: 16, 24 or 32 (default 24)\n";
+}
+
+bool parseOptions(int argc, char **argv, Options &options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            return false;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--midi") {
+            options.midi = value;
+        } else if (arg == "--state") {
+            options.state = value;
+        } else if (arg == "--out") {
+            options.output = value;
+        } else if (arg == "--stats") {
+            options.stats = value;
+        } else if (arg == "--sample-rate") {
+            options.sampleRate = std::stod(value);
+        } else if (arg == "--block-size") {
+            options.blockSize = std::max(1, std::stoi(value));
+        } else if (arg == "--threads") {
+            options.numThreads = std::max(0, std::stoi(value));
+        } else if (arg == "--tail") {
+            options.tail = std::max(0.0, std::stod(value));
+        } else if (arg == "--bits") {
+            options.bitDepth = std::stoi(value);
+        } else {
+            std::cerr << "unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    if (options.midi.empty()) {
+        std::cerr << "--midi is required" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+juce::File toFile(const std::string &path) { return juce::File::getCurrentWorkingDirectory().getChildFile(path); }
+
+bool loadState(BerryAudioProcessor &processor, const juce::File &file) {
+    juce::MemoryBlock data;
+    if (!file.loadFileAsData(data)) {
+        std::cerr << "failed to read " << file.getFullPathName() << std::endl;
+        return false;
+    }
+    auto xml = juce::AudioProcessor::getXmlFromBinary(data.getData(), (int)data.getSize());
+    if (xml == nullptr) {
+        xml = juce::parseXML(data.toString());
+    }
+    if (xml == nullptr || !xml->hasTagName("BerryInstrument")) {
+        std::cerr << file.getFullPathName() << " is not a Berry state" << std::endl;
+        return false;
+    }
+    juce::MemoryBlock binary;
+    juce::AudioProcessor::copyXmlToBinary(*xml, binary);
+    processor.setStateInformation(binary.getData(), (int)binary.getSize());
+    return true;
+}
+
+// 全トラックを 1 つにまとめ、タイムスタンプを秒にする
+bool loadMidi(const juce::File &file, juce::MidiMessageSequence &sequence) {
+    juce::FileInputStream stream(file);
+    juce::MidiFile midiFile;
+    if (!stream.openedOk() || !midiFile.readFrom(stream)) {
+        std::cerr << "failed to read " << file.getFullPathName() << std::endl;
+        return false;
+    }
+    midiFile.convertTimestampTicksToSeconds();
+    for (int i = 0; i < midiFile.getNumTracks(); ++i) {
+        sequence.addSequence(*midiFile.getTrack(i), 0.0);
+    }
+    sequence.updateMatchedPairs();
+    return true;
+}
+
+// sorted は昇順に並んでいること
+double percentile(const std::vector<double> &sorted, double p) {
+    auto index = (size_t)std::ceil(p / 100.0 * sorted.size());
+    return sorted[std::min(sorted.size() - 1, index > 0 ? index - 1 : 0)];
+}
+}  // namespace
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+    juce::MidiMessageSequence sequence;
+    if (!loadMidi(toFile(options.midi), sequence)) {
+        return 1;
+    }
+
+    BerryAudioProcessor processor;
+    if (!options.state.empty() && !loadState(processor, toFile(options.state))) {
+        return 1;
+    }
+    *processor.allParams.voiceParams.RenderThreads = options.numThreads;
+    processor.setRateAndBufferSizeDetails(options.sampleRate, options.blockSize);
+    processor.prepareToPlay(options.sampleRate, options.blockSize);
+
+    std::unique_ptr<juce::AudioFormatWriter> writer;
+    if (!options.output.empty()) {
+        auto file = toFile(options.output);
+        file.deleteFile();
+        std::unique_ptr<juce::FileOutputStream> stream(file.createOutputStream());
+        juce::WavAudioFormat wav;
+        if (stream != nullptr) {
+            writer.reset(wav.createWriterFor(stream.get(), options.sampleRate, 2, options.bitDepth, {}, 0));
+        }
+        if (writer == nullptr) {
+            std::cerr << "failed to open " << file.getFullPathName() << std::endl;
+            return 1;
+        }
+        stream.release();  // writer が持つ
+    }
+
+    auto totalSamples = (juce::int64)std::ceil((sequence.getEndTime() + options.tail) * options.sampleRate);
+    juce::AudioBuffer<float> block(2, options.blockSize);
+    juce::MidiBuffer midi;
+    std::vector<double> blockSeconds;
+    blockSeconds.reserve((size_t)(totalSamples / options.blockSize + 1));
+    int nextEvent = 0;
+    for (juce::int64 position = 0; position < totalSamples; position += options.blockSize) {
+        auto numSamples = (int)std::min<juce::int64>(options.blockSize, totalSamples - position);
+        block.setSize(2, numSamples, false, false, true);
+        midi.clear();
+        auto blockEnd = (double)(position + numSamples) / options.sampleRate;
+        for (; nextEvent < sequence.getNumEvents(); ++nextEvent) {
+            auto &message = sequence.getEventPointer(nextEvent)->message;
+            if (message.getTimeStamp() >= blockEnd) {
+                break;
+            }
+            if (message.isMetaEvent()) {
+                continue;
+            }
+            auto offset = (int)(message.getTimeStamp() * options.sampleRate - position);
+            midi.addEvent(message, juce::jlimit(0, numSamples - 1, offset));
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        processor.processBlock(block, midi);
+        auto end = std::chrono::steady_clock::now();
+        blockSeconds.push_back(std::chrono::duration<double>(end - start).count());
+
+        if (writer != nullptr) {
+            writer->writeFromAudioSampleBuffer(block, 0, numSamples);
+        }
+    }
+    processor.releaseResources();
+    writer.reset();
+    if (!options.stats.empty()) {
+        auto csv = processor.renderStatsToCsv();
+        if (csv.empty() || !toFile(options.stats).replaceWithText(csv)) {
+            std::cerr << "failed to write " << options.stats << std::endl;
+            return 1;
+        }
+    }
+    if (blockSeconds.empty()) {
+        std::cerr << "nothing to render" << std::endl;
+        return 1;
+    }
+
+    auto audioSeconds = totalSamples / options.sampleRate;
+    auto renderSeconds = 0.0;
+    for (auto seconds : blockSeconds) {
+        renderSeconds += seconds;
+    }
+    std::sort(blockSeconds.begin(), blockSeconds.end());
+    auto budget = options.blockSize / options.sampleRate;  // 1 ブロックを実時間で描画するのに使える時間
+    std::cout << "rendered " << audioSeconds << " s in " << renderSeconds << " s (" << blockSeconds.size()
+              << " blocks of " << options.blockSize << " samples at " << options.sampleRate << " Hz)" << std::endl;
+    std::cout << "real-time factor: " << audioSeconds / renderSeconds << "x" << std::endl;
+    std::cout << "block time (us, % of " << budget * 1e6 << " us budget):" << std::endl;
+    const std::pair<const char *, double> percentiles[]{
+        {"p50", 50.0}, {"p90", 90.0}, {"p99", 99.0}, {"p99.9", 99.9}, {"max", 100.0}};
+    for (auto &[name, p] : percentiles) {
+        auto seconds = percentile(blockSeconds, p);
+        std::cout << "  " << name << ": " << seconds * 1e6 << " (" << seconds / budget * 100 << "%)" << std::endl;
+    }
+#if BERRY_PROFILE
+    // 並列に描画した分も足し合わせた CPU 時間なので、スレッドを使うと合計が実時間を超えることもある
+    ProfileStats::Snapshot profile;
+    if (processor.profileStats.snapshot(profile)) {
+        std::cout << "stage time (s, % of audio time):" << std::endl;
+        for (int i = 0; i < NUM_PROFILE_ZONES; ++i) {
+            auto zone = (PROFILE_ZONE)i;
+            std::cout << "  " << PROFILE_ZONE_NAMES[i] << ": " << profile.seconds(zone) << " ("
+                      << profile.load(zone) * 100 << "%)" << std::endl;
+        }
+    }
+#endif
+    return 0;
+}
@@ -198,9 +198,14 @@ void IncDecButton::sliderValueChanged(juce::Slider* _slider) {
 }
 
 //==============================================================================
-VoiceComponent::VoiceComponent(AllParams& allParams) : allParams(allParams), pitchBendRangeButton() {
+VoiceComponent::VoiceComponent(AllParams& allParams)
+    : allParams(allParams), pitchBendRangeButton(), polyphonyButton(), renderThreadsButton() {
     initIncDec(pitchBendRangeButton, allParams.voiceParams.PitchBendRange, this, *this);
+    initIncDec(polyphonyButton, allParams.voiceParams.Polyphony, this, *this);
+    initIncDec(renderThreadsButton, allParams.voiceParams.RenderThreads, this, *this);
     initLabel(pitchBendRangeLabel, "PB Range", *this);
+    initLabel(polyphonyLabel, "Polyphony", *this);
+    initLabel(renderThreadsLabel, "Threads", *this);
 
     startTimerHz(30.0f);
 }
@@ -213,19 +218,27 @@ void VoiceComponent::resized() {
     juce::Rectangle<int> bounds = getLocalBounds();
     bounds.reduce(0, 10);
     consumeLabeledIncDecButton(bounds, 60, pitchBendRangeLabel, pitchBendRangeButton);
+    consumeLabeledIncDecButton(bounds, 60, polyphonyLabel, polyphonyButton);
+    consumeLabeledIncDecButton(bounds, 60, renderThreadsLabel, renderThreadsButton);
 }
 void VoiceComponent::incDecValueChanged(IncDecButton* button) {
     if (button == &pitchBendRangeButton) {
         *allParams.voiceParams.PitchBendRange = pitchBendRangeButton.getValue();
+    } else if (button == &polyphonyButton) {
+        *allParams.voiceParams.Polyphony = polyphonyButton.getValue();
+    } else if (button == &renderThreadsButton) {
+        *allParams.voiceParams.RenderThreads = renderThreadsButton.getValue();
     }
 }
 void VoiceComponent::timerCallback() {
     pitchBendRangeButton.setValue(allParams.voiceParams.PitchBendRange->get(), juce::dontSendNotification);
+    polyphonyButton.setValue(allParams.voiceParams.Polyphony->get(), juce::dontSendNotification);
+    renderThreadsButton.setValue(allParams.voiceParams.RenderThreads->get(), juce::dontSendNotification);
 }
 
 //==============================================================================
 UtilComponent::UtilComponent(BerryAudioProcessor& processor)
-    : processor(processor), copyToClipboardButton(), pasteFromClipboardButton() {
+    : processor(processor), copyToClipboardButton(), pasteFromClipboardButton(), exportStatsButton() {
     copyToClipboardButton.setLookAndFeel(&berryLookAndFeel);
     copyToClipboardButton.setButtonText("Copy");
     copyToClipboardButton.addListener(this);
@@ -236,8 +249,15 @@ UtilComponent::UtilComponent(BerryAudioProcessor& processor)
     pasteFromClipboardButton.addListener(this);
     this->addAndMakeVisible(pasteFromClipboardButton);
 
+    // 描画時間の集計を CSV でクリップボードにコピーする
+    exportStatsButton.setLookAndFeel(&berryLookAndFeel);
+    exportStatsButton.setButtonText("Stats");
+    exportStatsButton.addListener(this);
+    this->addAndMakeVisible(exportStatsButton);
+
     initLabel(copyToClipboardLabel, "Copy", *this);
     initLabel(pasteFromClipboardLabel, "Paste", *this);
+    initLabel(exportStatsLabel, "Stats", *this);
 }
 
 UtilComponent::~UtilComponent() {}
@@ -249,36 +269,48 @@ void UtilComponent::resized() {
     bounds.reduce(0, 10);
     consumeLabeledComboBox(bounds, 60, copyToClipboardLabel, copyToClipboardButton);
     consumeLabeledComboBox(bounds, 60, pasteFromClipboardLabel, pasteFromClipboardButton);
+    consumeLabeledComboBox(bounds, 60, exportStatsLabel, exportStatsButton);
 }
 void UtilComponent::buttonClicked(juce::Button* button) {
     if (button == &copyToClipboardButton) {
         processor.copyToClipboard();
     } else if (button == &pasteFromClipboardButton) {
         processor.pasteFromClipboard();
+    } else if (button == &exportStatsButton) {
+        processor.copyRenderTimeStatsToClipboard();
     }
 }
 
 //==============================================================================
 StatusComponent::StatusComponent(int* polyphony,
-                                 TimeConsumptionState* timeConsumptionState,
+                                 juce::AudioParameterInt* maxPolyphony,
+                                 RenderTimeStats* renderTimeStats,
+                                 ProfileStats* profileStats,
                                  LatestDataProvider* latestDataProvider)
-    : polyphony(polyphony), timeConsumptionState(timeConsumptionState), latestDataProvider(latestDataProvider) {
-    latestDataProvider->addConsumer(&levelConsumer);
-
+    : polyphony(polyphony),
+      maxPolyphony(maxPolyphony),
+      renderTimeStats(renderTimeStats),
+      profileStats(profileStats),
+      latestDataProvider(latestDataProvider) {
     initStatusValue(volumeValueLabel, "0.0dB", *this);
     initStatusValue(polyphonyValueLabel, std::to_string(*polyphony), *this);
-    initStatusValue(timeConsumptionValueLabel,
-                    std::to_string(juce::roundToInt(timeConsumptionState->currentTimeConsumptionRate * 100)) + "%",
-                    *this);
+    initStatusValue(loadValueLabel, "0% / 0%", *this);
+    initStatusValue(maxLoadValueLabel, "0%", *this);
 
     initStatusKey(volumeLabel, "Peak", *this);
     initStatusKey(polyphonyLabel, "Polyphony", *this);
-    initStatusKey(timeConsumptionLabel, "Busyness", *this);
+    initStatusKey(loadLabel, "p50/p99", *this);
+    initStatusKey(maxLoadLabel, "Max", *this);
+#if BERRY_PROFILE
+    // 直近で最も時間のかかった段 (内訳は Stats でコピーする CSV にある)
+    initStatusValue(heaviestZoneValueLabel, "-", *this);
+    initStatusKey(heaviestZoneLabel, "Heaviest", *this);
+#endif
 
     startTimerHz(4.0f);
 }
 
-StatusComponent::~StatusComponent() { latestDataProvider->removeConsumer(&levelConsumer); }
+StatusComponent::~StatusComponent() {}
 
 void StatusComponent::paint(juce::Graphics& g) {}
 
@@ -287,11 +319,21 @@ void StatusComponent::resized() {
     bounds.reduce(0, 10);
     auto boundsHeight = bounds.getHeight();
     auto boundsWidth = bounds.getWidth();
-    consumeKeyValueText(bounds, boundsHeight / 3, boundsWidth * 0.4, volumeLabel, volumeValueLabel);
-    consumeKeyValueText(bounds, boundsHeight / 3, boundsWidth * 0.4, polyphonyLabel, polyphonyValueLabel);
-    consumeKeyValueText(bounds, boundsHeight / 3, boundsWidth * 0.4, timeConsumptionLabel, timeConsumptionValueLabel);
+#if BERRY_PROFILE
+    auto rowHeight = boundsHeight / 5;
+#else
+    auto rowHeight = boundsHeight / 4;
+#endif
+    consumeKeyValueText(bounds, rowHeight, boundsWidth * 0.4, volumeLabel, volumeValueLabel);
+    consumeKeyValueText(bounds, rowHeight, boundsWidth * 0.4, polyphonyLabel, polyphonyValueLabel);
+    consumeKeyValueText(bounds, rowHeight, boundsWidth * 0.4, loadLabel, loadValueLabel);
+    consumeKeyValueText(bounds, rowHeight, boundsWidth * 0.4, maxLoadLabel, maxLoadValueLabel);
+#if BERRY_PROFILE
+    consumeKeyValueText(bounds, rowHeight, boundsWidth * 0.4, heaviestZoneLabel, heaviestZoneValueLabel);
+#endif
 }
 void StatusComponent::timerCallback() {
+    latestDataProvider->pull(levelConsumer);
     if (overflowWarning > 0) {
         volumeValueLabel.setColour(juce::Label::textColourId, colour::ERROR);
         auto levelStr = juce::String(overflowedLevel, 1) + " dB";
@@ -315,7 +357,7 @@ void StatusComponent::timerCallback() {
         }
     }
     {
-        int numVoices = 64;  // TODO: share this
+        int numVoices = maxPolyphony->get();
         int value = *polyphony;
         polyphonyValueLabel.setText(juce::String(value), juce::dontSendNotification);
         if (value >= numVoices) {
@@ -327,17 +369,49 @@ void StatusComponent::timerCallback() {
         }
     }
     {
-        auto value = timeConsumptionState->currentTimeConsumptionRate;
-        timeConsumptionValueLabel.setText(juce::String(juce::roundToInt(value * 100)) + "%",
-                                          juce::dontSendNotification);
-        if (value >= 1.0) {
-            timeConsumptionValueLabel.setColour(juce::Label::textColourId, colour::ERROR);
-        } else if (value >= 0.8) {
-            timeConsumptionValueLabel.setColour(juce::Label::textColourId, colour::WARNING);
-        } else {
-            timeConsumptionValueLabel.setColour(juce::Label::textColourId, colour::TEXT);
+        // 締め切りに対する描画時間の割合を、直近 2 秒くらいのブロックについて出す
+        RenderTimeStats::Snapshot current;
+        if (renderTimeStats->snapshot(current)) {
+            auto recent = current.since(statsHistory[statsHistoryIndex]);
+            statsHistory[statsHistoryIndex] = current;
+            statsHistoryIndex = (statsHistoryIndex + 1) % numStatsHistory;
+
+            auto toPercent = [](double load) { return juce::String(juce::roundToInt(load * 100)) + "%"; };
+            auto p99 = recent.percentile(0.99);
+            auto max = recent.percentile(1.0);
+            loadValueLabel.setText(toPercent(recent.percentile(0.5)) + " / " + toPercent(p99),
+                                   juce::dontSendNotification);
+            maxLoadValueLabel.setText(toPercent(max), juce::dontSendNotification);
+            auto colourFor = [](double load) {
+                return load >= 1.0 ? colour::ERROR : load >= 0.8 ? colour::WARNING : colour::TEXT;
+            };
+            loadValueLabel.setColour(juce::Label::textColourId, colourFor(p99));
+            maxLoadValueLabel.setColour(juce::Label::textColourId,
+                                        recent.numDeadlineMisses > 0 ? colour::ERROR : colourFor(max));
+        }
+    }
+#if BERRY_PROFILE
+    {
+        // 直近の区間で CPU 時間の最も長かった段と、音の長さに対するその割合
+        ProfileStats::Snapshot current;
+        if (profileStats->snapshot(current)) {
+            auto recent = current.since(profileHistory[profileHistoryIndex]);
+            profileHistory[profileHistoryIndex] = current;
+            profileHistoryIndex = (profileHistoryIndex + 1) % numStatsHistory;
+
+            auto heaviest = 0;
+            for (int i = 1; i < NUM_PROFILE_ZONES; ++i) {
+                if (recent.ticks.ticks[i] > recent.ticks.ticks[heaviest]) {
+                    heaviest = i;
+                }
+            }
+            auto load = recent.load((PROFILE_ZONE)heaviest);
+            heaviestZoneValueLabel.setText(
+                load > 0 ? PROFILE_ZONE_NAMES[heaviest] + " " + juce::String(juce::roundToInt(load * 100)) + "%" : "-",
+                juce::dontSendNotification);
         }
     }
+#endif
 }
 
 //==============================================================================
@@ -1307,15 +1381,9 @@ AnalyserWindow::AnalyserWindow(ANALYSER_MODE* analyserMode, LatestDataProvider*
       latestDataProvider(latestDataProvider),
       forwardFFT(fftOrder),
       window(fftSize, juce::dsp::WindowingFunction<float>::hann) {
-    latestDataProvider->addConsumer(&fftConsumer);
-    latestDataProvider->addConsumer(&levelConsumer);
-
     startTimerHz(30.0f);
 }
-AnalyserWindow::~AnalyserWindow() {
-    latestDataProvider->removeConsumer(&fftConsumer);
-    latestDataProvider->removeConsumer(&levelConsumer);
-}
+AnalyserWindow::~AnalyserWindow() {}
 
 void AnalyserWindow::resized() {}
 void AnalyserWindow::timerCallback() {
@@ -1325,6 +1393,8 @@ void AnalyserWindow::timerCallback() {
     switch (*analyserMode) {
         case ANALYSER_MODE::Spectrum: {
             lastAnalyserMode = ANALYSER_MODE::Spectrum;
+            latestDataProvider->pull(fftConsumer);
+            latestDataProvider->pull(levelConsumer);
             if (fftConsumer.ready) {
                 auto hasData = drawNextFrameOfSpectrum();
                 fftConsumer.ready = false;
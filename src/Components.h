@@ -419,8 +419,12 @@ private:
     AllParams& allParams;
 
     IncDecButton pitchBendRangeButton;
+    IncDecButton polyphonyButton;
+    IncDecButton renderThreadsButton;
 
     juce::Label pitchBendRangeLabel;
+    juce::Label polyphonyLabel;
+    juce::Label renderThreadsLabel;
 };
 
 //==============================================================================
@@ -441,15 +445,21 @@ private:
 
     juce::TextButton copyToClipboardButton;
     juce::TextButton pasteFromClipboardButton;
+    juce::TextButton exportStatsButton;
 
     juce::Label copyToClipboardLabel;
     juce::Label pasteFromClipboardLabel;
+    juce::Label exportStatsLabel;
 };
 
 //==============================================================================
 class StatusComponent : public juce::Component, private juce::Timer, ComponentHelper {
 public:
-    StatusComponent(int* polyphony, TimeConsumptionState* timeConsumptionState, LatestDataProvider* latestDataProvider);
+    StatusComponent(int* polyphony,
+                    juce::AudioParameterInt* maxPolyphony,
+                    RenderTimeStats* renderTimeStats,
+                    ProfileStats* profileStats,
+                    LatestDataProvider* latestDataProvider);
     virtual ~StatusComponent();
     StatusComponent(const StatusComponent&) = delete;
 
@@ -459,16 +469,29 @@ public:
 private:
     virtual void timerCallback() override;
     int* polyphony;
-    TimeConsumptionState* timeConsumptionState;
+    juce::AudioParameterInt* maxPolyphony;
+    RenderTimeStats* renderTimeStats;
+    ProfileStats* profileStats;
     LatestDataProvider* latestDataProvider;
 
     juce::Label volumeValueLabel;
     juce::Label polyphonyValueLabel;
-    juce::Label timeConsumptionValueLabel;
+    juce::Label loadValueLabel;
+    juce::Label maxLoadValueLabel;
+    juce::Label heaviestZoneValueLabel;
 
     juce::Label volumeLabel;
     juce::Label polyphonyLabel;
-    juce::Label timeConsumptionLabel;
+    juce::Label loadLabel;
+    juce::Label maxLoadLabel;
+    juce::Label heaviestZoneLabel;
+
+    // 直近 (タイマー numStatsHistory 回分) の負荷の分布を出すために、過去の集計を取っておく
+    enum { numStatsHistory = 8 };
+    RenderTimeStats::Snapshot statsHistory[numStatsHistory];
+    int statsHistoryIndex = 0;
+    ProfileStats::Snapshot profileHistory[numStatsHistory];
+    int profileHistoryIndex = 0;
 
     float levelDataL[2048];
     float levelDataR[2048];
@@ -5,7 +5,11 @@ const int NUM_TIMBRES = 4;
 const int NUM_OSC = 16;
 const int NUM_NOISE = 2;
 const int NUM_NOISE_FILTER = 2;
+const int MAX_VOICES = 64;
+const int MAX_RENDER_THREADS = 8;  // ボイスを並列に描画するワーカーの数の上限
 const int MIN_OF_88_NOTES = 21;   // A0
 const int MAX_OF_88_NOTES = 108;  // C8
 const int DEFAULT_TIMBRE_NOTES[NUM_TIMBRES] = {MIN_OF_88_NOTES, 48, 72, MAX_OF_88_NOTES};
+const float MIN_DELAY_TIME = 0.01f;  // sec
+const float MAX_DELAY_TIME = 1.0f;   // sec
 }  // namespace
\ No newline at end of file
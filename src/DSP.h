@@ -2,7 +2,9 @@
 
 #include <JuceHeader.h>
 
+#include "Fft.h"
 #include "MathConstants.h"
+#include "Wavetable.h"
 
 using namespace math_constants;
 
@@ -27,36 +29,17 @@ const juce::StringArray DELAY_TYPE_NAMES = juce::StringArray("Parallel", "Ping-P
 }  // namespace
 
 //==============================================================================
-class Wavetable {
-public:
-    const int *lookup = reinterpret_cast<const int *>(BinaryData::lookup);
-    const float *sine = reinterpret_cast<const float *>(BinaryData::sine);
-    const float *saw = reinterpret_cast<const float *>(BinaryData::saw);  // 128 variations
-    Wavetable(){};
-    ~Wavetable(){};
-    Wavetable(const Wavetable &) = delete;
-    double getSineValue(double normalizedAngle) {
-        normalizedAngle = std::fmod(normalizedAngle, 1.0);
-        return getValue(sine, normalizedAngle);
-    }
-    double getSawDownValue(double freq, double normalizedAngle) {
-        normalizedAngle = std::fmod(normalizedAngle, 1.0);
-        const float *partial = getPartial(saw, freq);
-        return getValue(partial, normalizedAngle);
-    }
-
-private:
-    double getValue(const float *partial, float normalizedAngle) {
-        float indexFloat = normalizedAngle * 4095;
-        int index = indexFloat;
-        float fragment = indexFloat - index;
-        return partial[index] * (1 - fragment) + partial[index + 1] * fragment;
-    }
-    const float *getPartial(const float *data, double freq) {
-        int partialIndex = lookup[freq >= 22000 ? 21999 : (int)freq];
-        return &data[partialIndex * 4096];
-    }
-};
+// ボイスの DSP チェーンで使うサンプルの型。
+// 位相の積算やフィルター係数の計算のように精度が要る所は、この型に関係なく double で計算する。
+// BERRY_DOUBLE_PRECISION を 1 にするとすべて double になる (float にする前と同じ結果になる)
+#ifndef BERRY_DOUBLE_PRECISION
+#define BERRY_DOUBLE_PRECISION 0
+#endif
+#if BERRY_DOUBLE_PRECISION
+using VoiceSample = double;
+#else
+using VoiceSample = float;
+#endif
 
 //==============================================================================
 enum class TRANSITION_TYPE {
@@ -65,9 +48,10 @@ enum class TRANSITION_TYPE {
     EXPONENTIAL,
     EXPONENTIAL2,
 };
+template <typename T>
 class TransitiveValue {
 public:
-    double value = 0;
+    T value = 0;
     TransitiveValue(){};
     ~TransitiveValue(){};
     TransitiveValue(const TransitiveValue &) = delete;
@@ -165,9 +149,9 @@ public:
 
 private:
     TRANSITION_TYPE type = TRANSITION_TYPE::NONE;
-    double targetValue = 0;
-    double stepAmount1 = 0;
-    double stepAmount2 = 0;
+    T targetValue = 0;
+    T stepAmount1 = 0;
+    T stepAmount2 = 0;
     int steps = 0;
     double endThreshold = 0;
     double setTargetAtTime(double initialValue, double targetValue, double pos);
@@ -194,167 +178,360 @@ enum class ADSR_PHASE {
 static constexpr int ADSR_BASE = 0;
 static constexpr int ADSR_PEAK = 1;
 static constexpr double ADSR_STOP_THRESHOLD = 0.005;
-class Adsr {
+/*
+  1 ボイス分のエンベロープ (形は上の図の通り) を N 本まとめて SoA で持ち、コントロールレートで一斉に進める。
+  linear / exponentialFinite / exponentialInfinite のどの区間も、区間の始めから k ティック目の値は閉じた式
+  value = base + scale * a^k + slope * k で書ける (linear は a = 1・scale = 0、指数の区間は slope = 0)。
+  値を前の値から求めないので誤差が溜まらず、全レーンを同じ式で分岐無しに計算できる。
+  区間の終わりに来たものや減衰しきったものがあるかも同じループでまとめて調べ、あったときだけ 1 本ずつ切り替える。
+  1 ティックの間は getPreviousValue() から getValue() までを線形に補間して使う (getRamp)。
+*/
+template <typename T, int N>
+class EnvelopeBank {
 public:
-    Adsr(){};
-    ~Adsr(){};
-    Adsr(const Adsr &) = delete;
-    double getValue() { return tvalue.value; }
-    bool isActive() { return phase != ADSR_PHASE::WAIT; }
-    bool isReleasing() { return phase == ADSR_PHASE::RELEASE; }
-    void setParams(double curve, double a, double h, double d, double s, double r) {
-        attackCurve = curve;
-        attack = a;
-        hold = h;
-        decay = d;
-        sustain = s;
-        release = r;
-    }
-    void doAttack(double sampleRate) {
-        phase = ADSR_PHASE::ATTACK;
-        tvalue.exponentialFinite(attack, ADSR_PEAK, attackCurve, sampleRate);
-    }
-    void doRelease(double sampleRate) {
-        phase = ADSR_PHASE::RELEASE;
-        tvalue.exponentialInfinite(release, ADSR_BASE, sampleRate);
-    }
-    void doRelease(double sampleRate, double duration) {
-        phase = ADSR_PHASE::RELEASE;
-        tvalue.exponentialInfinite(duration, ADSR_BASE, sampleRate);
-    }
-    void forceStop() {
-        tvalue.init(ADSR_BASE);
-        phase = ADSR_PHASE::WAIT;
+    EnvelopeBank() {
+        for (int i = 0; i < N; ++i) {
+            forceStop(i);
+            previousValues[i] = ADSR_BASE;
+        }
+    }
+    ~EnvelopeBank() {}
+    EnvelopeBank(const EnvelopeBank &) = delete;
+    T getValue(int i) const { return values[i]; }
+    T getPreviousValue(int i) const { return previousValues[i]; }
+    // 前のティックから今のティックまでの区間の position ~ position + length の部分 (区間の長さを 1 とする) の両端の値
+    void getRamp(int i, T position, T length, T &start, T &end) const {
+        auto delta = values[i] - previousValues[i];
+        start = previousValues[i] + delta * position;
+        end = previousValues[i] + delta * (position + length);
     }
+    bool isActive(int i) const { return phases[i] != ADSR_PHASE::WAIT; }
+    bool isReleasing(int i) const { return phases[i] == ADSR_PHASE::RELEASE; }
+    void setParams(int i, double curve, double a, double h, double d, double s, double r) {
+        params[i] = {curve, a, h, d, s, r};
+    }
+    void doAttack(int i, double sampleRate) {
+        setPhase(i, ADSR_PHASE::ATTACK);
+        exponentialFinite(i, params[i].attack, ADSR_PEAK, params[i].attackCurve, sampleRate);
+    }
+    void doRelease(int i, double sampleRate) { doRelease(i, sampleRate, params[i].release); }
+    void doRelease(int i, double sampleRate, double duration) {
+        setPhase(i, ADSR_PHASE::RELEASE);
+        exponentialInfinite(i, duration, ADSR_BASE, sampleRate);
+    }
+    void forceStop(int i) {
+        setPhase(i, ADSR_PHASE::WAIT);
+        values[i] = ADSR_BASE;
+        hold(i);
+    }
+    // 全エンベロープを 1 ティック進める
     void step(double sampleRate) {
-        // TODO: 途中でパラメータを変えた場合にアサーションに引っかかる
-        switch (phase) {
-            case ADSR_PHASE::ATTACK: {
-                if (tvalue.step()) {
-                    phase = ADSR_PHASE::HOLD;
-                    tvalue.linear(hold, peak, sampleRate);
+        std::copy_n(values, N, previousValues);
+        int changed = 0;
+        for (int i = 0; i < N; ++i) {
+            powers[i] *= multipliers[i];
+            ticks[i] += 1;
+            values[i] = bases[i] + scales[i] * (T)powers[i] + slopes[i] * ticks[i];
+            remaining[i]--;
+            changed |= (previousValues[i] < stopThresholds[i]) | (remaining[i] < 0);
+        }
+        if (!changed) {
+            return;
+        }
+        for (int i = 0; i < N; ++i) {
+            // 進める前に減衰しきっていたものは止める (止めたティックは前の値から 0 まで補間される)
+            if (previousValues[i] < stopThresholds[i]) {
+                forceStop(i);
+            } else if (remaining[i] < 0) {
+                // HOLD の次の DECAY でいきなり減衰しきった (decay が 0 で sustain も 0) ものはすぐに止める
+                auto wasHolding = phases[i] == ADSR_PHASE::HOLD;
+                values[i] = targets[i];
+                nextSegment(i, sampleRate);
+                if (wasHolding && values[i] < ADSR_STOP_THRESHOLD) {
+                    forceStop(i);
                 }
-                //                jassert(tvalue.value <= peak);
-                break;
             }
-            case ADSR_PHASE::HOLD: {
-                if (tvalue.step()) {
-                    phase = ADSR_PHASE::DECAY;
-                    tvalue.exponentialInfinite(decay, sustain, sampleRate);
-                }
-                //                jassert(tvalue.value == peak);
-                if (tvalue.value < ADSR_STOP_THRESHOLD) {
-                    forceStop();
-                }
+        }
+    }
+
+private:
+    struct Params {
+        double attackCurve;  // 0-1
+        double attack;       // sec
+        double hold;         // sec
+        double decay;        // sec
+        double sustain;      // 0-1
+        double release;      // sec
+    };
+    // 区間が終わらないものは remaining をこれにしておく
+    enum { FOREVER = 0x7fffffff };
+    alignas(32) T values[N];
+    alignas(32) T previousValues[N];
+    // 今の区間の閉じた式の係数と、区間の始めからのティック数 (powers は multipliers^ticks)。
+    // a^k は a の丸め誤差が k に比例して効いてくるので、T に関係なく double で持つ
+    alignas(32) T bases[N];
+    alignas(32) T scales[N];
+    alignas(32) T slopes[N];
+    alignas(32) double multipliers[N];
+    alignas(32) double powers[N];
+    alignas(32) T ticks[N];
+    alignas(32) int remaining[N];
+    // 進める前の値がこれより小さければ止める。DECAY / SUSTAIN / RELEASE の間だけ ADSR_STOP_THRESHOLD
+    alignas(32) T stopThresholds[N];
+    T targets[N];
+    ADSR_PHASE phases[N];
+    Params params[N]{};
+
+    void setPhase(int i, ADSR_PHASE phase) {
+        phases[i] = phase;
+        auto decaying = phase == ADSR_PHASE::DECAY || phase == ADSR_PHASE::SUSTAIN || phase == ADSR_PHASE::RELEASE;
+        stopThresholds[i] = decaying ? ADSR_STOP_THRESHOLD : -1.0;
+    }
+    void nextSegment(int i, double sampleRate) {
+        switch (phases[i]) {
+            case ADSR_PHASE::ATTACK:
+                setPhase(i, ADSR_PHASE::HOLD);
+                linear(i, params[i].hold, ADSR_PEAK, sampleRate);
                 break;
-            }
-            case ADSR_PHASE::DECAY: {
-                if (tvalue.value < ADSR_STOP_THRESHOLD) {
-                    forceStop();
-                    break;
-                }
-                if (tvalue.step()) {
-                    phase = ADSR_PHASE::SUSTAIN;
-                }
-                //                jassert(tvalue.value >= sustain);
+            case ADSR_PHASE::HOLD:
+                setPhase(i, ADSR_PHASE::DECAY);
+                exponentialInfinite(i, params[i].decay, params[i].sustain, sampleRate);
                 break;
-            }
-            case ADSR_PHASE::SUSTAIN: {
-                if (tvalue.value < ADSR_STOP_THRESHOLD) {
-                    forceStop();
-                    break;
-                }
-                //                jassert(tvalue.value == sustain);
+            case ADSR_PHASE::DECAY:
+                setPhase(i, ADSR_PHASE::SUSTAIN);
+                hold(i);
                 break;
-            }
-            case ADSR_PHASE::RELEASE: {
-                if (tvalue.value < ADSR_STOP_THRESHOLD) {
-                    forceStop();
-                    break;
-                }
-                if (tvalue.step()) {
-                    forceStop();
-                }
-                //                jassert(tvalue.value >= base);
+            case ADSR_PHASE::RELEASE:
+                forceStop(i);
                 break;
-            }
-            case ADSR_PHASE::WAIT: {
-                //                jassert(tvalue.value == base);
+            case ADSR_PHASE::SUSTAIN:
+            case ADSR_PHASE::WAIT:
+                hold(i);
                 break;
-            }
         }
     }
-
-private:
-    double attackCurve;  // 0-1
-    double attack;       // ms
-    double hold;         // ms
-    double decay;        // ms
-    double sustain;      // 0-1
-    double release;      // ms
-    double base = 0;     // 0-1
-    double peak = 1;     // 0-1
-    ADSR_PHASE phase = phase = ADSR_PHASE::WAIT;
-    TransitiveValue tvalue;
+    // 以下は TransitiveValue と同じ区間を、今の値から始まる閉じた式の係数にしたもの。
+    // duration が 0 なら目標の値に飛び、次のティックで区間が終わる
+    void startSegment(
+        int i, double base, double scale, double slope, double multiplier, double targetValue, int length) {
+        bases[i] = base;
+        scales[i] = scale;
+        slopes[i] = slope;
+        multipliers[i] = multiplier;
+        powers[i] = 1;
+        ticks[i] = 0;
+        targets[i] = targetValue;
+        remaining[i] = length;
+    }
+    void hold(int i) { startSegment(i, values[i], 0.0, 0.0, 1.0, values[i], FOREVER); }
+    void jump(int i, double targetValue) {
+        values[i] = targetValue;
+        startSegment(i, targetValue, 0.0, 0.0, 1.0, targetValue, 0);
+    }
+    void linear(int i, double duration, double targetValue, double sampleRate) {
+        if (duration == 0) {
+            return jump(i, targetValue);
+        }
+        auto slope = (targetValue - values[i]) / sampleRate / duration;
+        startSegment(i, values[i], 0.0, slope, 1.0, targetValue, (int)(sampleRate * duration));
+    }
+    void exponentialFinite(int i, double duration, double targetValue, double curveFactor, double sampleRate) {
+        if (curveFactor == 0.5) {
+            return linear(i, duration, targetValue, sampleRate);
+        }
+        jassert(curveFactor > 0);
+        jassert(curveFactor < 1);
+        if (duration == 0) {
+            return jump(i, targetValue);
+        }
+        auto steps = duration * sampleRate;
+        auto aN = std::pow((1 - curveFactor) / curveFactor, 2);
+        auto a = std::pow(aN, 1.0 / steps);
+        // steps ティックで targetValue に着く value = value * a + b の不動点 b / (1 - a) を base にする
+        auto base = (targetValue - values[i] * aN) / (1 - aN);
+        startSegment(i, base, values[i] - base, 0.0, a, targetValue, (int)steps);
+    }
+    void exponentialInfinite(int i, double duration, double targetValue, double sampleRate) {
+        if (duration == 0) {
+            return jump(i, targetValue);
+        }
+        auto a = std::pow(0.37, 1.0 / sampleRate / duration);  // 63% 減衰する時間とする
+        auto length = (int)(std::log(0.005) / std::log(a));
+        startSegment(i, targetValue, values[i] - targetValue, 0.0, a, targetValue, length);
+    }
 };
 
 //==============================================================================
 namespace {
 const int NUM_FEEDFORWARD = 3;
 const int NUM_FEEDBACK = 2;
-const int NUM_PAST = 2;
 }  // namespace
+// 係数と状態は T で持つ (係数の計算は double)
+template <typename T>
 class Filter {
 public:
     Filter() {}
     ~Filter() { DBG("Filter's destructor called."); }
     Filter(const Filter &) = delete;
-    void initializePastData() { past[0][0] = past[0][1] = past[1][0] = past[1][1] = 0; }
+    void initializePastData() {
+        std::fill_n(state1, 2, 0.0);
+        std::fill_n(state2, 2, 0.0);
+        // 鳴り始めは前のノートの係数から補間せず、次の setParams() の値をそのまま使う
+        jumpToTarget = true;
+    }
     void setSampleRate(double sampleRate) {
         if (this->sampleRate != sampleRate) {
             reciprocal_sampleRate = 1.0 / sampleRate;
         }
         this->sampleRate = sampleRate;
     }
-    double step(FILTER_TYPE filterType, double freq, double q, double dbGain, int ch, double input) {
-        jassert(ch < 2);
+    // コントロールレートで呼ぶ。係数が変わった時は続く numSamples サンプルをかけて線形に補間する。
+    // 2 次の分母の安定領域 (a1, a2 の三角形) は凸なので、安定な係数同士を補間している途中も安定。
+    void setParams(FILTER_TYPE filterType, double freq, double q, double dbGain, int numSamples) {
         jassert(sampleRate != 0.0);
         jassert(reciprocal_sampleRate > 0.0);
-        setParams(filterType, freq, q, dbGain);
-
-        double *p = past[ch];
-        // apply b
+        freq = std::min(sampleRate * 0.5 - 10, freq);
+        auto changed =
+            filterType != currentFilterType || freq != currentFreq || q != currentQ || dbGain != currentDbGain;
+        if (changed) {
+            calculateCoefficients(filterType, freq, q, dbGain);
+        } else if (!jumpToTarget) {
+            return;
+        }
+        if (jumpToTarget || numSamples <= 0) {
+            std::copy_n(feedforward, NUM_FEEDFORWARD, activeFeedforward);
+            std::copy_n(feedback, NUM_FEEDBACK, activeFeedback);
+            rampRemaining = 0;
+            jumpToTarget = false;
+            return;
+        }
+        auto reciprocal_numSamples = 1.0 / numSamples;
+        for (auto j = 0; j < NUM_FEEDFORWARD; j++) {
+            deltaFeedforward[j] = (feedforward[j] - activeFeedforward[j]) * reciprocal_numSamples;
+        }
         for (auto j = 0; j < NUM_FEEDBACK; j++) {
-            input -= p[j] * feedback[j];
+            deltaFeedback[j] = (feedback[j] - activeFeedback[j]) * reciprocal_numSamples;
+        }
+        rampRemaining = numSamples;
+    }
+    // L/R 1 サンプル分をその場でフィルタする
+    void step(T *frame) {
+        if (rampRemaining > 0) {
+            advanceRamp();
+        }
+        tick(frame[0], frame[1]);
+    }
+    // L/R の numSamples サンプルをその場でフィルタする
+    void process(T *left, T *right, int numSamples) {
+        int i = 0;
+        for (; i < numSamples && rampRemaining > 0; ++i) {
+            advanceRamp();
+            tick(left[i], right[i]);
         }
-        // apply a
-        auto o = input * feedforward[0];
-        for (auto j = 1; j < NUM_FEEDFORWARD; j++) {
-            o += p[j - 1] * feedforward[j];
+        Filter *self = this;
+        processStatic(&self, 1, left + i, right + i, numSamples - i);
+    }
+    // 直列につないだフィルタを順に通す。
+    // 係数を補間している区間だけは 1 段ずつ処理し、残りは全段を 1 サンプルずつまとめて回す (中間結果をメモリに戻さない)
+    static void processCascade(Filter *const *filters, int numFilters, T *left, T *right, int numSamples) {
+        jassert(numFilters <= MAX_CASCADE);
+        int rampLength = 0;
+        for (int f = 0; f < numFilters; ++f) {
+            rampLength = std::max(rampLength, std::min(filters[f]->rampRemaining, numSamples));
         }
-        // unshift f.past
-        for (auto j = NUM_PAST - 2; j >= 0; j--) {
-            p[j + 1] = p[j];
+        if (rampLength > 0) {
+            for (int f = 0; f < numFilters; ++f) {
+                filters[f]->process(left, right, rampLength);
+            }
         }
-        p[0] = input;
-        return o;
+        processStatic(filters, numFilters, left + rampLength, right + rampLength, numSamples - rampLength);
     }
 
 private:
-    double feedforward[NUM_FEEDFORWARD];
-    double feedback[NUM_FEEDBACK];
-    double past[2][NUM_PAST]{};
+    enum { MAX_CASCADE = 4 };
+    T feedforward[NUM_FEEDFORWARD]{};
+    T feedback[NUM_FEEDBACK]{};
+    T activeFeedforward[NUM_FEEDFORWARD]{};
+    T activeFeedback[NUM_FEEDBACK]{};
+    T deltaFeedforward[NUM_FEEDFORWARD]{};
+    T deltaFeedback[NUM_FEEDBACK]{};
+    int rampRemaining = 0;
+    bool jumpToTarget = true;
+    // transposed direct form II の状態。L/R を並べて 1 つの SIMD レジスタで計算できるようにしている
+    alignas(16) T state1[2]{};
+    alignas(16) T state2[2]{};
     double sampleRate = 0.0;
     double reciprocal_sampleRate = -1;
     FILTER_TYPE currentFilterType = FILTER_TYPE::Lowpass;
     double currentFreq = 0.0;
     double currentQ = 0.0;
     double currentDbGain = 0.0;
-    void setParams(FILTER_TYPE filterType, double freq, double q, double dbGain) {
-        freq = std::min(sampleRate * 0.5 - 10, freq);
-        if (filterType == currentFilterType && freq == currentFreq && q == currentQ && dbGain == currentDbGain) {
+    void advanceRamp() {
+        if (--rampRemaining == 0) {
+            // 誤差が溜まらないように最後は目標の係数に揃える
+            std::copy_n(feedforward, NUM_FEEDFORWARD, activeFeedforward);
+            std::copy_n(feedback, NUM_FEEDBACK, activeFeedback);
+            return;
+        }
+        for (auto j = 0; j < NUM_FEEDFORWARD; j++) {
+            activeFeedforward[j] += deltaFeedforward[j];
+        }
+        for (auto j = 0; j < NUM_FEEDBACK; j++) {
+            activeFeedback[j] += deltaFeedback[j];
+        }
+    }
+    void tick(T &left, T &right) {
+        alignas(16) T x[2]{left, right};
+        alignas(16) T y[2];
+        for (int lane = 0; lane < 2; ++lane) {
+            y[lane] = activeFeedforward[0] * x[lane] + state1[lane];
+            state1[lane] = activeFeedforward[1] * x[lane] - activeFeedback[0] * y[lane] + state2[lane];
+            state2[lane] = activeFeedforward[2] * x[lane] - activeFeedback[1] * y[lane];
+        }
+        left = y[0];
+        right = y[1];
+    }
+    // 係数が動かない区間。全段の係数と状態をローカルに持って回す
+    static void processStatic(Filter *const *filters, int numFilters, T *left, T *right, int numSamples) {
+        if (numSamples <= 0 || numFilters <= 0) {
             return;
         }
+        T b0[MAX_CASCADE], b1[MAX_CASCADE], b2[MAX_CASCADE], a1[MAX_CASCADE], a2[MAX_CASCADE];
+        alignas(16) T s1[MAX_CASCADE][2];
+        alignas(16) T s2[MAX_CASCADE][2];
+        for (int f = 0; f < numFilters; ++f) {
+            auto &filter = *filters[f];
+            b0[f] = filter.activeFeedforward[0];
+            b1[f] = filter.activeFeedforward[1];
+            b2[f] = filter.activeFeedforward[2];
+            a1[f] = filter.activeFeedback[0];
+            a2[f] = filter.activeFeedback[1];
+            for (int lane = 0; lane < 2; ++lane) {
+                s1[f][lane] = filter.state1[lane];
+                s2[f][lane] = filter.state2[lane];
+            }
+        }
+        for (int i = 0; i < numSamples; ++i) {
+            alignas(16) T x[2]{left[i], right[i]};
+            for (int f = 0; f < numFilters; ++f) {
+                for (int lane = 0; lane < 2; ++lane) {
+                    auto y = b0[f] * x[lane] + s1[f][lane];
+                    s1[f][lane] = b1[f] * x[lane] - a1[f] * y + s2[f][lane];
+                    s2[f][lane] = b2[f] * x[lane] - a2[f] * y;
+                    x[lane] = y;
+                }
+            }
+            left[i] = x[0];
+            right[i] = x[1];
+        }
+        for (int f = 0; f < numFilters; ++f) {
+            for (int lane = 0; lane < 2; ++lane) {
+                filters[f]->state1[lane] = s1[f][lane];
+                filters[f]->state2[lane] = s2[f][lane];
+            }
+        }
+    }
+    void calculateCoefficients(FILTER_TYPE filterType, double freq, double q, double dbGain) {
         switch (filterType) {
             case FILTER_TYPE::Lowpass: {
                 setLowpassParams(freq, q);
@@ -572,18 +749,17 @@ private:
 };
 
 //==============================================================================
+// 位相は double で積算し、出力だけ T にする
+template <typename T>
 class Osc {
 public:
     Osc() {}
     ~Osc() { DBG("Osc's destructor called."); }
     Osc(const Osc &) = delete;
-    void setWaveform(WAVEFORM waveform, bool useWavetable) {
-        this->waveform = waveform;
-        this->useWavetable = useWavetable;
-    }
+    void setWaveform(WAVEFORM waveform) { this->waveform = waveform; }
     void setSampleRate(double sampleRate) { reciprocal_sampleRate = 1.0 / sampleRate; }
     void setNormalizedAngle(double normalizedAngle) { currentNormalizedAngle = normalizedAngle; }
-    double step(double freq, double normalizedAngleShift) {
+    T step(double freq, double normalizedAngleShift) {
         if (reciprocal_sampleRate <= 0.0) {
             return 0.0;
         }
@@ -596,67 +772,593 @@ public:
         switch (waveform) {
             case WAVEFORM::Sine:
                 return std::sin(normalizedAngle * TWO_PI);
-                // return wavetable.getSineValue(normalizedAngle);
             case WAVEFORM::Saw:
-                if (useWavetable) {
-                    return wavetable.getSawDownValue(freq, normalizedAngle);
-                } else {
-                    normalizedAngle = std::fmod(normalizedAngle, 1.0);
-                    return normalizedAngle * -2.0 + 1.0;
-                }
-            case WAVEFORM::Pink: {
-                auto white = (whiteNoise.nextDouble() * 2.0 - 1.0) * 0.5;
-                bool eco = true;
-                if (eco) {
-                    pink[0] = 0.99765 * pink[0] + white * 0.0990460;
-                    pink[1] = 0.96300 * pink[1] + white * 0.2965164;
-                    pink[2] = 0.57000 * pink[2] + white * 1.0526913;
-                    auto value = pink[0] + pink[1] + pink[2] + white * 0.1848;
-                    return value;
-                } else {
-                    pink[0] = 0.99886 * pink[0] + white * 0.0555179;
-                    pink[1] = 0.99332 * pink[1] + white * 0.0750759;
-                    pink[2] = 0.96900 * pink[2] + white * 0.1538520;
-                    pink[3] = 0.86650 * pink[3] + white * 0.3104856;
-                    pink[4] = 0.55000 * pink[4] + white * 0.5329522;
-                    pink[5] = -0.7616 * pink[5] - white * 0.0168980;
-                    auto value = pink[0] + pink[1] + pink[2] + pink[3] + pink[4] + pink[5] + pink[6] + white * 0.5362;
-                    pink[6] = white * 0.115926;
-                    return value;
-                }
-            }
-            case WAVEFORM::White:
-                return whiteNoise.nextDouble() * 2.0 - 1.0;
+                // 帯域制限していないノコギリ波 (帯域制限したものは WavetableOsc で鳴らす)
+                normalizedAngle = std::fmod(normalizedAngle, 1.0);
+                return normalizedAngle * -2.0 + 1.0;
+            default:
+                jassertfalse;
+                return 0.0;
         }
     }
 
 private:
-    Wavetable wavetable;
     double currentNormalizedAngle = 0.0;
-    double pink[7]{};
-    juce::Random whiteNoise;
     WAVEFORM waveform = WAVEFORM::Sine;
-    bool useWavetable = true;
     double reciprocal_sampleRate = -1;
 };
 
 //==============================================================================
+/*
+  ホワイトノイズ / ピンクノイズをブロック単位で作る。
+  乱数は xoshiro256+ を NUM_LANES 本並べて SoA で持ち、1 回の更新で NUM_LANES サンプル分を作る (自動ベクトル化される)。
+  同じシードからは同じ列になるので、ボイスごとにシードを決めておけばオフラインで書き出しても再現できる。
+*/
+class NoiseGenerator {
+public:
+    NoiseGenerator() { setSeed(0); }
+    ~NoiseGenerator() { DBG("NoiseGenerator's destructor called."); }
+    NoiseGenerator(const NoiseGenerator &) = delete;
+    void setWaveform(WAVEFORM waveform) {
+        jassert(waveform == WAVEFORM::White || waveform == WAVEFORM::Pink);
+        this->waveform = waveform;
+    }
+    void setSeed(uint64_t seed) {
+        // splitmix64 で各レーンの初期状態を作る (全部 0 にはならない)
+        for (int k = 0; k < 4; ++k) {
+            for (int lane = 0; lane < NUM_LANES; ++lane) {
+                seed += 0x9e3779b97f4a7c15ULL;
+                auto z = seed;
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+                state[k][lane] = z ^ (z >> 31);
+            }
+        }
+        numPending = 0;
+        std::fill_n(pink, 4, 0.0);
+    }
+    double step() {
+        if (numPending == 0) {
+            nextLanes(pending);
+            numPending = NUM_LANES;
+        }
+        auto white = pending[NUM_LANES - numPending--];
+        return waveform == WAVEFORM::Pink ? stepPink(white) : white;
+    }
+    // -1 ~ 1 のノイズを numSamples 分 out に書く
+    template <typename Sample>
+    void fill(Sample *out, int numSamples) {
+        int i = 0;
+        for (; i < numSamples && numPending > 0; ++i) {
+            out[i] = pending[NUM_LANES - numPending--];
+        }
+        auto numGroups = (numSamples - i) / NUM_LANES;
+        nextLanes(out + i, numGroups);
+        i += numGroups * NUM_LANES;
+        if (i < numSamples) {
+            nextLanes(pending);
+            numPending = NUM_LANES;
+            for (; i < numSamples; ++i) {
+                out[i] = pending[NUM_LANES - numPending--];
+            }
+        }
+        if (waveform == WAVEFORM::Pink) {
+            fillPink(out, numSamples);
+        }
+    }
+
+private:
+    enum { NUM_LANES = 4 };
+    alignas(32) uint64_t state[4][NUM_LANES];
+    alignas(32) double pending[NUM_LANES]{};
+    int numPending = 0;
+    alignas(32) double pink[4]{};
+    WAVEFORM waveform = WAVEFORM::White;
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+    // xoshiro256+ を全レーン numGroups 回ずつ進めて、-1 ~ 1 の値を out に NUM_LANES * numGroups 個書く。
+    // 状態はローカルにコピーして回す (out と別の領域だと分かるのでベクトル化される)
+    template <typename Sample>
+    void nextLanes(Sample *out, int numGroups = 1) {
+        alignas(32) uint64_t s0[NUM_LANES], s1[NUM_LANES], s2[NUM_LANES], s3[NUM_LANES];
+        std::copy_n(state[0], NUM_LANES, s0);
+        std::copy_n(state[1], NUM_LANES, s1);
+        std::copy_n(state[2], NUM_LANES, s2);
+        std::copy_n(state[3], NUM_LANES, s3);
+        for (int g = 0; g < numGroups; ++g) {
+            alignas(32) double values[NUM_LANES];
+            for (int lane = 0; lane < NUM_LANES; ++lane) {
+                auto result = s0[lane] + s3[lane];
+                auto t = s1[lane] << 17;
+                s2[lane] ^= s0[lane];
+                s3[lane] ^= s1[lane];
+                s1[lane] ^= s2[lane];
+                s0[lane] ^= s3[lane];
+                s2[lane] ^= t;
+                s3[lane] = rotl(s3[lane], 45);
+                // 上位 52 bit を仮数部にして 1 ~ 2 の double を作り、-1 ~ 1 に直す (整数から double への変換を避ける)
+                auto bits = (result >> 12) | 0x3ff0000000000000ULL;
+                std::memcpy(&values[lane], &bits, sizeof(double));
+            }
+            for (int lane = 0; lane < NUM_LANES; ++lane) {
+                out[g * NUM_LANES + lane] = values[lane] * 2.0 - 3.0;
+            }
+        }
+        std::copy_n(s0, NUM_LANES, state[0]);
+        std::copy_n(s1, NUM_LANES, state[1]);
+        std::copy_n(s2, NUM_LANES, state[2]);
+        std::copy_n(s3, NUM_LANES, state[3]);
+    }
+    // Paul Kellet の簡易版ピンクノイズフィルタ。
+    // 3 つの 1 次フィルタと素通しの分を 4 レーンに並べ、全レーンの和を出力にする
+    static constexpr double PINK_POLES[4] = {0.99765, 0.96300, 0.57000, 0.0};
+    static constexpr double PINK_GAINS[4] = {0.0990460 * 0.5, 0.2965164 * 0.5, 1.0526913 * 0.5, 0.1848 * 0.5};
+    double stepPink(double white) {
+        fillPink(&white, 1);
+        return white;
+    }
+    template <typename Sample>
+    void fillPink(Sample *data, int numSamples) {
+        alignas(32) double p[4];
+        std::copy_n(pink, 4, p);
+        for (int i = 0; i < numSamples; ++i) {
+            double white = data[i];
+            for (int lane = 0; lane < 4; ++lane) {
+                p[lane] = PINK_POLES[lane] * p[lane] + white * PINK_GAINS[lane];
+            }
+            data[i] = (p[0] + p[1]) + (p[2] + p[3]);
+        }
+        std::copy_n(p, 4, pink);
+    }
+};
+
+//==============================================================================
+namespace {
+const int WAVETABLE_BITS = 12;
+const int WAVETABLE_SIZE = 1 << WAVETABLE_BITS;  // 1 周期のサンプル数
+const int WAVETABLE_FRACTION_BITS = 32 - WAVETABLE_BITS;
+const uint32_t WAVETABLE_FRACTION_MASK = (1u << WAVETABLE_FRACTION_BITS) - 1;
+const double WAVETABLE_MAX_FREQ = 22000.0;  // これより上の倍音はテーブルに入れない
+}  // namespace
+
+/*
+  1 周期の波形を、含む倍音の数を変えて何段階か持っておく (ミップマップ)。
+  段 k は最大 (WAVETABLE_SIZE / 2 - 1) * 2^(-k / levelsPerOctave) 倍音までを含み、
+  鳴らす周波数ごとにその周波数で折り返さない一番豊かな段を選ぶ。
+  テーブルの長さは 2 のべき乗で、末尾に先頭のサンプルを 1 つ足してあるので、補間のときに添字を折り返さなくてよい。
+*/
+class WavetableBank {
+public:
+    WavetableBank() {}
+    ~WavetableBank() {}
+    WavetableBank(const WavetableBank &) = delete;
+    // spectrum(h, maxHarmonic) は、最大 maxHarmonic 倍音の段での h 倍音の複素振幅 (e^{ihθ} の係数)。
+    // 最初の段は highestHarmonic 倍音まで。lowestHarmonic より少ない倍音しか入らない段は作らない (その周波数では無音)。
+    // 全体は最も豊かな段のピークが 1 になるように正規化する。
+    // waveformId はキャッシュに書いて取り違えを防ぐための波形の番号
+    template <typename Spectrum>
+    void build(wavetable::WAVEFORM_ID waveformId,
+               Spectrum &&spectrum,
+               int levelsPerOctave,
+               int lowestHarmonic = 1,
+               int highestHarmonic = WAVETABLE_SIZE / 2 - 1) {
+        jassert(levelsPerOctave > 0);
+        jassert(highestHarmonic < WAVETABLE_SIZE / 2);
+        this->waveformId = waveformId;
+        this->levelsPerOctave = levelsPerOctave;
+        maxHarmonics = wavetable::getMaxHarmonics(levelsPerOctave, lowestHarmonic, highestHarmonic);
+        spectrumHash = wavetable::hashSpectrum(spectrum, maxHarmonics);
+        auto numLevels = (int)maxHarmonics.size();
+        ownedTables.assign((size_t)numLevels * (WAVETABLE_SIZE + 1), 0.0f);
+        std::vector<std::complex<double>> data(WAVETABLE_SIZE);
+        float scale = 1.0f;
+        for (int k = 0; k < numLevels; ++k) {
+            std::fill(data.begin(), data.end(), std::complex<double>());
+            for (int h = 1; h <= maxHarmonics[k]; ++h) {
+                auto c = std::complex<double>(spectrum(h, maxHarmonics[k]));
+                data[h] = c;
+                data[WAVETABLE_SIZE - h] = std::conj(c);
+            }
+            fft::transform(data, true);
+            auto *table = &ownedTables[(size_t)k * (WAVETABLE_SIZE + 1)];
+            float peak = 0.0f;
+            for (int i = 0; i < WAVETABLE_SIZE; ++i) {
+                table[i] = (float)data[i].real();
+                peak = std::max(peak, std::abs(table[i]));
+            }
+            if (k == 0 && peak > 0.0f) {
+                scale = 1.0f / peak;
+            }
+            for (int i = 0; i < WAVETABLE_SIZE; ++i) {
+                table[i] *= scale;
+            }
+            table[WAVETABLE_SIZE] = table[0];
+        }
+        tables = ownedTables.data();
+    }
+    // wavetable::getWaveform() の波形から作る
+    void build(const wavetable::Waveform &waveform, int levelsPerOctave) {
+        build(waveform.id,
+              waveform.spectrum,
+              waveform.levelsPerOctave > 0 ? waveform.levelsPerOctave : levelsPerOctave,
+              waveform.lowestHarmonic,
+              waveform.highestHarmonic > 0 ? waveform.highestHarmonic : WAVETABLE_SIZE / 2 - 1);
+    }
+    // 任意の 1 周期の波形 (長さは 2 のべき乗) から作る
+    void buildFromWaveform(wavetable::WAVEFORM_ID waveformId, const float *cycle, int length, int levelsPerOctave) {
+        jassert(length > 1 && (length & (length - 1)) == 0);
+        std::vector<std::complex<double>> data(cycle, cycle + length);
+        fft::transform(data, false);
+        build(
+            waveformId,
+            [&](int h, int) {
+                return h < length / 2 ? data[h] / (double)length : std::complex<double>();
+            },
+            levelsPerOctave);
+    }
+
+    // キャッシュファイル用の形式 (wavetable::CACHE_FORMAT_VERSION の説明を参照)
+    size_t getSerializedSize() const {
+        return sizeof(int32_t) * (HEADER_SIZE + maxHarmonics.size()) +
+               sizeof(float) * maxHarmonics.size() * (WAVETABLE_SIZE + 1);
+    }
+    void serialize(char *dest) const {
+        auto *body = dest + sizeof(int32_t) * HEADER_SIZE;
+        auto bodySize = getSerializedSize() - sizeof(int32_t) * HEADER_SIZE;
+        std::memcpy(body, maxHarmonics.data(), sizeof(int32_t) * maxHarmonics.size());
+        std::memcpy(body + sizeof(int32_t) * maxHarmonics.size(),
+                    tables,
+                    sizeof(float) * maxHarmonics.size() * (WAVETABLE_SIZE + 1));
+        int32_t header[HEADER_SIZE]{wavetable::CACHE_FORMAT_VERSION,
+                                    WAVETABLE_BITS,
+                                    (int32_t)levelsPerOctave,
+                                    (int32_t)maxHarmonics.size(),
+                                    (int32_t)waveformId,
+                                    (int32_t)spectrumHash,
+                                    (int32_t)wavetable::hashBody(body, bodySize)};
+        std::memcpy(dest, header, sizeof(header));
+    }
+    // serialize() で書いたデータをコピーせずに参照する (data は this より長く生きていること)。
+    // waveform はこのバンクに期待する波形で、番号かスペクトルのハッシュがヘッダと違えば読まない。
+    // 中身のハッシュが合わない (壊れている、途中で切れている) 時も読まない。
+    // 読めた場合は読んだバイト数、形式が合わない場合は 0 を返す
+    size_t attach(const char *data, size_t size, const wavetable::Waveform &waveform, int levelsPerOctave) {
+        int32_t header[HEADER_SIZE];
+        if (size < sizeof(header)) {
+            return 0;
+        }
+        std::memcpy(header, data, sizeof(header));
+        if (header[0] != wavetable::CACHE_FORMAT_VERSION || header[1] != WAVETABLE_BITS || header[2] <= 0 ||
+            header[3] <= 0) {
+            return 0;
+        }
+        levelsPerOctave = waveform.levelsPerOctave > 0 ? waveform.levelsPerOctave : levelsPerOctave;
+        auto expectedHarmonics = wavetable::getMaxHarmonics(
+            levelsPerOctave,
+            waveform.lowestHarmonic,
+            waveform.highestHarmonic > 0 ? waveform.highestHarmonic : WAVETABLE_SIZE / 2 - 1);
+        auto expectedHash = wavetable::hashSpectrum(waveform.spectrum, expectedHarmonics);
+        if (header[2] != levelsPerOctave || header[4] != (int32_t)waveform.id || (uint32_t)header[5] != expectedHash) {
+            return 0;
+        }
+        auto numLevels = (size_t)header[3];
+        auto tablesOffset = sizeof(int32_t) * (HEADER_SIZE + numLevels);
+        auto totalSize = tablesOffset + sizeof(float) * numLevels * (WAVETABLE_SIZE + 1);
+        if (size < totalSize || reinterpret_cast<uintptr_t>(data + tablesOffset) % alignof(float) != 0) {
+            return 0;
+        }
+        if ((uint32_t)header[6] != wavetable::hashBody(data + sizeof(header), totalSize - sizeof(header))) {
+            return 0;
+        }
+        maxHarmonics.resize(numLevels);
+        std::memcpy(maxHarmonics.data(), data + sizeof(header), sizeof(int32_t) * numLevels);
+        if (maxHarmonics != expectedHarmonics) {
+            return 0;
+        }
+        this->waveformId = waveform.id;
+        this->levelsPerOctave = levelsPerOctave;
+        spectrumHash = expectedHash;
+        ownedTables.clear();
+        tables = reinterpret_cast<const float *>(data + tablesOffset);
+        return totalSize;
+    }
+
+    int getNumLevels() const { return (int)maxHarmonics.size(); }
+    // 基音が freq の時に使う段。maxFreq より上の倍音を含まない一番豊かな段を返す (どの段も当てはまらなければ -1)
+    int getLevel(double freq, double maxFreq) const {
+        if (freq <= 0.0) {
+            return 0;
+        }
+        auto ratio = maxHarmonics[0] * freq / maxFreq;
+        // 段ごとの倍音数は切り捨てているので、対数から求めた段の少し手前から探す
+        auto k = ratio <= 1.0 ? 0 : std::max(0, (int)(levelsPerOctave * std::log2(ratio)) - 1);
+        while (k < getNumLevels() && maxHarmonics[k] * freq > maxFreq) {
+            ++k;
+        }
+        return k < getNumLevels() ? k : -1;
+    }
+    const float *getTable(int level) const { return tables + (size_t)level * (WAVETABLE_SIZE + 1); }
+
+private:
+    enum { HEADER_SIZE = wavetable::CACHE_HEADER_SIZE };
+    const float *tables = nullptr;  // ownedTables かマップしたファイルの中を指す
+    std::vector<float> ownedTables;
+    std::vector<int32_t> maxHarmonics;
+    int levelsPerOctave = 1;
+    wavetable::WAVEFORM_ID waveformId = wavetable::WAVEFORM_ID::Sine;
+    uint32_t spectrumHash = 0;
+};
+
+//==============================================================================
+/*
+  全ボイス・全インスタンスで共有するウェーブテーブル。
+  juce::SharedResourcePointer で持つと、プロセスの中で一度だけ作られる。
+  作ったテーブルはキャッシュファイルにも書いておき、次からはメモリマップして読む
+  (別のプロセスで動いているインスタンスとも物理メモリを共有できる)。ファイルが使えない時はメモリ上に作るだけ。
+  波形の定義は wavetable-gen と共通 (Wavetable.h) なので、既定の設定で生成したファイルもそのまま読める。
+*/
+class WavetableStore {
+public:
+    WavetableStore() {
+        auto cacheFile = getCacheFile();
+        if (!loadCache(cacheFile)) {
+            buildAll();
+            saveCache(cacheFile);
+        }
+    }
+    ~WavetableStore() {}
+    WavetableStore(const WavetableStore &) = delete;
+    // 16 倍音から上のノコギリ波 (15 倍音まではサイン波のオシレーターが鳴らす)
+    const WavetableBank &getSawHigh() const { return sawHigh; }
+    const WavetableBank &getSine() const { return sine; }
+    static juce::File getCacheFile() {
+        return juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+            .getChildFile("Berry")
+            .getChildFile("wavetables.cache");
+    }
+
+private:
+    WavetableBank sawHigh;
+    WavetableBank sine;
+    std::unique_ptr<juce::MemoryMappedFile> mappedFile;
+    enum { NUM_BANKS = 2 };
+    WavetableBank *getBank(int index) { return index == 0 ? &sawHigh : &sine; }
+    static wavetable::Waveform getWaveform(int index) {
+        return wavetable::getWaveform(index == 0 ? wavetable::WAVEFORM_ID::SawHigh : wavetable::WAVEFORM_ID::Sine);
+    }
+
+    void buildAll() {
+        for (int i = 0; i < NUM_BANKS; ++i) {
+            getBank(i)->build(getWaveform(i), wavetable::DEFAULT_LEVELS_PER_OCTAVE);
+        }
+    }
+    bool loadCache(const juce::File &file) {
+        if (!file.existsAsFile()) {
+            return false;
+        }
+        mappedFile = std::make_unique<juce::MemoryMappedFile>(file, juce::MemoryMappedFile::readOnly);
+        const auto *data = static_cast<const char *>(mappedFile->getData());
+        auto size = mappedFile->getSize();
+        for (int i = 0; i < NUM_BANKS && data != nullptr; ++i) {
+            auto consumed = getBank(i)->attach(data, size, getWaveform(i), wavetable::DEFAULT_LEVELS_PER_OCTAVE);
+            if (consumed == 0) {
+                data = nullptr;
+                break;
+            }
+            data += consumed;
+            size -= consumed;
+        }
+        if (data == nullptr || size != 0) {
+            mappedFile.reset();
+            return false;
+        }
+        return true;
+    }
+    void saveCache(const juce::File &file) {
+        size_t size = 0;
+        for (int i = 0; i < NUM_BANKS; ++i) {
+            size += getBank(i)->getSerializedSize();
+        }
+        std::vector<char> data(size);
+        auto *dest = data.data();
+        for (int i = 0; i < NUM_BANKS; ++i) {
+            getBank(i)->serialize(dest);
+            dest += getBank(i)->getSerializedSize();
+        }
+        // 書けなくてもメモリ上のテーブルで動くので失敗は無視する
+        if (file.getParentDirectory().createDirectory().wasOk()) {
+            file.replaceWithData(data.data(), data.size());
+        }
+    }
+};
+
+//==============================================================================
+// WavetableBank を 32bit 固定小数点の位相で読むオシレーター。位相の回り込みは整数のオーバーフローに任せる
+class WavetableOsc {
+public:
+    WavetableOsc(const WavetableBank &bank) : bank(bank) {}
+    ~WavetableOsc() { DBG("WavetableOsc's destructor called."); }
+    WavetableOsc(const WavetableOsc &) = delete;
+    void setSampleRate(double sampleRate) {
+        phaseScale = sampleRate > 0.0 ? 4294967296.0 / sampleRate : 0.0;
+        maxFreq = std::min(WAVETABLE_MAX_FREQ, sampleRate * 0.5);
+        currentFreq = -1.0;
+    }
+    void setNormalizedAngle(double normalizedAngle) {
+        phase = (uint32_t)(int64_t)(normalizedAngle * 4294967296.0);
+    }
+    double step(double freq) {
+        if (phaseScale <= 0.0) {
+            return 0.0;
+        }
+        if (freq != currentFreq) {
+            currentFreq = freq;
+            currentLevel = bank.getLevel(freq, maxFreq);
+        }
+        phase += toPhaseIncrement(freq * phaseScale);
+        return currentLevel < 0 ? 0.0 : lookup(bank.getTable(currentLevel), phase);
+    }
+    // freqs[i] * freqRatio の周波数で numSamples 分を outL/outR に足し込む。
+    // ゲインは gainL/gainR から targetGainL/targetGainR まで線形に動かす (最後のサンプルで target になる)。
+    // 段はブロックの中で一番高い周波数で選ぶ (コントロールレートの区間なら端のどちらか)
+    template <typename Sample>
+    void addBlock(const double *freqs,
+                  double freqRatio,
+                  double gainL,
+                  double gainR,
+                  double targetGainL,
+                  double targetGainR,
+                  Sample *outL,
+                  Sample *outR,
+                  int numSamples) {
+        if (phaseScale <= 0.0 || numSamples <= 0) {
+            return;
+        }
+        auto scale = freqRatio * phaseScale;
+        auto level = bank.getLevel(std::max(freqs[0], freqs[numSamples - 1]) * freqRatio, maxFreq);
+        if (level < 0) {
+            for (int i = 0; i < numSamples; ++i) {
+                phase += toPhaseIncrement(freqs[i] * scale);
+            }
+            return;
+        }
+        const auto *table = bank.getTable(level);
+        auto deltaL = (targetGainL - gainL) / numSamples;
+        auto deltaR = (targetGainR - gainR) / numSamples;
+        // NUM_LANES サンプルずつ、位相の増分と補間はレーンごとにまとめて計算する (ベクトル化される)。
+        // 位相の累積は前のサンプルに依存するので整数の足し算だけを順番に行い、表を引くのもレーンごとになる
+        auto p = phase;
+        int i = 0;
+        for (; i + NUM_LANES <= numSamples; i += NUM_LANES) {
+            alignas(32) uint32_t phases[NUM_LANES];
+            alignas(32) float values[NUM_LANES];
+            for (int lane = 0; lane < NUM_LANES; ++lane) {
+                phases[lane] = toPhaseIncrement(freqs[i + lane] * scale);
+            }
+            for (int lane = 0; lane < NUM_LANES; ++lane) {
+                p += phases[lane];
+                phases[lane] = p;
+            }
+            lookupLanes(table, phases, values);
+            for (int lane = 0; lane < NUM_LANES; ++lane) {
+                gainL += deltaL;
+                gainR += deltaR;
+                outL[i + lane] += values[lane] * gainL;
+                outR[i + lane] += values[lane] * gainR;
+            }
+        }
+        for (; i < numSamples; ++i) {
+            p += toPhaseIncrement(freqs[i] * scale);
+            auto value = lookup(table, p);
+            gainL += deltaL;
+            gainR += deltaR;
+            outL[i] += value * gainL;
+            outR[i] += value * gainR;
+        }
+        phase = p;
+    }
+
+private:
+    enum { NUM_LANES = 8 };
+    const WavetableBank &bank;
+    uint32_t phase = 0;
+    double phaseScale = 0.0;
+    double maxFreq = WAVETABLE_MAX_FREQ;
+    double currentFreq = -1.0;
+    int currentLevel = -1;
+    // 0 以上の increment を一番近い整数に丸めて、下位 32bit を位相の増分にする。
+    // 2^52 を足すと仮数部の下位がそのまま整数になるので、uint32_t への変換と違ってベクトル化できる
+    static uint32_t toPhaseIncrement(double increment) {
+        auto shifted = increment + 4503599627370496.0;
+        uint64_t bits;
+        std::memcpy(&bits, &shifted, sizeof(bits));
+        return (uint32_t)bits;
+    }
+    static double lookup(const float *table, uint32_t phase) {
+        auto index = phase >> WAVETABLE_FRACTION_BITS;
+        auto fraction = (float)(phase & WAVETABLE_FRACTION_MASK) * (1.0f / (1u << WAVETABLE_FRACTION_BITS));
+        auto a = table[index];
+        return a + (table[index + 1] - a) * fraction;
+    }
+    // lookup を NUM_LANES 個まとめて。表を引くところ以外は全レーン同じ計算になる
+    static void lookupLanes(const float *table, const uint32_t *phases, float *values) {
+        alignas(32) float a[NUM_LANES];
+        alignas(32) float b[NUM_LANES];
+        for (int lane = 0; lane < NUM_LANES; ++lane) {
+            auto index = phases[lane] >> WAVETABLE_FRACTION_BITS;
+            a[lane] = table[index];
+            b[lane] = table[index + 1];
+        }
+        for (int lane = 0; lane < NUM_LANES; ++lane) {
+            // 小数部は 2^20 未満なので int32_t を経由して変換する (符号なしからの変換より速い)
+            auto fraction =
+                (float)(int32_t)(phases[lane] & WAVETABLE_FRACTION_MASK) * (1.0f / (1u << WAVETABLE_FRACTION_BITS));
+            values[lane] = a[lane] + (b[lane] - a[lane]) * fraction;
+        }
+    }
+};
+
+//==============================================================================
+// saw なら高次倍音のテーブル (WavetableStore::getSawHigh) を WavetableOsc で、それ以外はサイン波を Osc で鳴らす
+template <typename T>
 class MultiOsc {
 public:
-    MultiOsc(bool saw) { osc.setWaveform(saw ? WAVEFORM::Saw : WAVEFORM::Sine, true); }
+    MultiOsc(bool saw) : saw(saw), wavetableOsc(wavetables->getSawHigh()) { osc.setWaveform(WAVEFORM::Sine); }
     ~MultiOsc() { DBG("MultiOsc's destructor called."); }
     MultiOsc(const MultiOsc &) = delete;
-    void setSampleRate(double sampleRate) { osc.setSampleRate(sampleRate); }
-    void step(double pan, double freq, double normalizedAngleShift, double gain, double *outout) {
+    void setSampleRate(double sampleRate) {
+        osc.setSampleRate(sampleRate);
+        wavetableOsc.setSampleRate(sampleRate);
+    }
+    void setNormalizedAngle(double normalizedAngle) {
+        osc.setNormalizedAngle(normalizedAngle);
+        wavetableOsc.setNormalizedAngle(normalizedAngle);
+    }
+    void step(double pan, double freq, double normalizedAngleShift, double gain, T *outout) {
         calcPan(1, pan, 0, 0);
-        auto value = osc.step(freq, normalizedAngleShift) * gain;
+        auto value = (saw ? wavetableOsc.step(freq) : osc.step(freq, normalizedAngleShift)) * gain;
         for (int ch = 0; ch < 2; ch++) {
             outout[ch] = value * pans[ch];
         }
     }
+    // freqs[i] * freqRatio の周波数で numSamples 分を outL/outR に足し込む。
+    // ゲインは gain から targetGain まで線形に動かす
+    void addBlock(double pan,
+                  const double *freqs,
+                  double freqRatio,
+                  double gain,
+                  double targetGain,
+                  T *outL,
+                  T *outR,
+                  int numSamples) {
+        calcPan(1, pan, 0, 0);
+        auto panL = pans[0];
+        auto panR = pans[1];
+        if (saw) {
+            wavetableOsc.addBlock(freqs,
+                                  freqRatio,
+                                  gain * panL,
+                                  gain * panR,
+                                  targetGain * panL,
+                                  targetGain * panR,
+                                  outL,
+                                  outR,
+                                  numSamples);
+            return;
+        }
+        auto delta = (targetGain - gain) / numSamples;
+        for (int i = 0; i < numSamples; ++i) {
+            gain += delta;
+            auto value = osc.step(freqs[i] * freqRatio, 0.0) * gain;
+            outL[i] += value * panL;
+            outR[i] += value * panR;
+        }
+    }
 
 private:
-    Osc osc;
+    bool saw;
+    juce::SharedResourcePointer<WavetableStore> wavetables;
+    Osc<T> osc;
+    WavetableOsc wavetableOsc;
     double pans[2]{std::cos(0.5 * HALF_PI), std::sin(0.5 * HALF_PI)};
     double currentPan = 0.0;
     void calcPan(int numOsc, double pan, double detune, double spread) {
@@ -672,11 +1374,392 @@ private:
 };
 
 //==============================================================================
+namespace {
+const int NUM_HARMONIC_LANES = 16;
+}  // namespace
+enum class HARMONIC_ENGINE {
+    Polynomial = 0,  // 位相を積算して多項式でサインを近似する
+    Recursive,       // 複素数の回転 (回転フェーザー) の漸化式で進める
+};
+/*
+  倍音をまとめて計算するための構造体配列 (SoA)。
+  各レーンは基音の ratios[k] = k + 1 倍の周波数を持ち、全レーンを 1 サンプルずつ同時に進める。
+  内側のループはレーン方向に依存関係が無いので、コンパイラが SSE/AVX/NEON でベクトル化できる。
+
+  coherent の場合は基音 (レーン 0) の位相だけを積算し、他のレーンの位相はそこから求める。
+  倍音同士の位相がずれず、resetPhases() した後の出力はボイスの履歴に依存しなくなる。
+*/
+class HarmonicBank {
+public:
+    HarmonicBank() {
+        std::fill_n(lanePhasorRe, NUM_HARMONIC_LANES, 1.0);
+        loadLanes();
+    }
+    ~HarmonicBank() {}
+    HarmonicBank(const HarmonicBank &) = delete;
+    void setSampleRate(double sampleRate) {
+        auto reciprocal = 1.0 / sampleRate;
+        if (reciprocal != reciprocal_sampleRate) {
+            rotationFreq = 0.0;
+        }
+        reciprocal_sampleRate = reciprocal;
+    }
+    void setEngine(HARMONIC_ENGINE engine) {
+        if (engine == this->engine) {
+            return;
+        }
+        // 位相を引き継いで切り替える
+        storeLanes();
+        for (int k = 0; k < NUM_HARMONIC_LANES; ++k) {
+            if (engine == HARMONIC_ENGINE::Recursive) {
+                lanePhasorRe[k] = std::cos(lanePhases[k] * TWO_PI);
+                lanePhasorIm[k] = std::sin(lanePhases[k] * TWO_PI);
+            } else {
+                lanePhases[k] = std::atan2(lanePhasorIm[k], lanePhasorRe[k]) / TWO_PI;
+            }
+        }
+        this->engine = engine;
+        loadLanes();
+    }
+    void setCoherent(bool coherent) {
+        this->coherent = coherent;
+        setActiveLanes(activeLanes);
+    }
+    bool isCoherent() { return coherent; }
+    void resetPhases() {
+        std::fill_n(lanePhases, NUM_HARMONIC_LANES, 0.0);
+        std::fill_n(lanePhasorRe, NUM_HARMONIC_LANES, 1.0);
+        std::fill_n(lanePhasorIm, NUM_HARMONIC_LANES, 0.0);
+        loadLanes();
+    }
+    void setGain(int lane, double gain) { setGainRamp(lane, gain, gain); }
+    // 次の addBlock() の間にゲインを gain から targetGain まで線形に動かす (最後のサンプルで targetGain になる)
+    void setGainRamp(int lane, double gain, double targetGain) {
+        laneGains[lane] = gain;
+        laneTargetGains[lane] = targetGain;
+        if (activeLanes & (1u << lane)) {
+            gains[slots[lane]] = gain;
+            targetGains[slots[lane]] = targetGain;
+        }
+    }
+    // 計算するレーンをビットマスクで指定する。止めたレーンの位相は進まない
+    void setActiveLanes(uint32_t mask) {
+        if (coherent) {
+            mask |= 1;  // 基音の位相は常に必要
+        }
+        if (mask == activeLanes) {
+            return;
+        }
+        storeLanes();
+        activeLanes = mask;
+        loadLanes();
+    }
+    // freqs[i] を基音として有効なレーンを合成し、パンを掛けて outL/outR に足し込む。
+    // Recursive は freqs[0] から freqs[numSamples - 1] まで周波数が線形に動くものとして扱う
+    // (ボイスはコントロールレートの区間ごとに呼ぶので、区間の中の周波数はいつも線形になる)
+    template <typename Sample>
+    void addBlock(double pan, const double *freqs, Sample *outL, Sample *outR, int numSamples) {
+        if (numActive == 0) {
+            return;
+        }
+        calcPan(pan);
+        auto reciprocal_numSamples = 1.0 / numSamples;
+        for (int j = 0; j < NUM_HARMONIC_LANES; ++j) {
+            gainDeltas[j] = (targetGains[j] - gains[j]) * reciprocal_numSamples;
+        }
+        switch (engine) {
+            case HARMONIC_ENGINE::Polynomial:
+                if (coherent) {
+                    addBlockPolynomialCoherent(freqs, outL, outR, numSamples);
+                } else if (numPadded == NUM_HARMONIC_LANES) {
+                    addBlockPolynomial<NUM_HARMONIC_LANES>(freqs, outL, outR, numSamples);
+                } else {
+                    addBlockPolynomial<0>(freqs, outL, outR, numSamples);
+                }
+                break;
+            case HARMONIC_ENGINE::Recursive:
+                prepareRotation(freqs, numSamples);
+                if (coherent) {
+                    addBlockRecursiveCoherent(outL, outR, numSamples);
+                } else if (numPadded == NUM_HARMONIC_LANES) {
+                    addBlockRecursive<NUM_HARMONIC_LANES>(outL, outR, numSamples);
+                } else {
+                    addBlockRecursive<0>(outL, outR, numSamples);
+                }
+                break;
+        }
+        // 誤差が溜まらないように最後は目標のゲインに揃える
+        for (int j = 0; j < numActive; ++j) {
+            gains[j] = targetGains[j];
+            laneGains[lanes[j]] = targetGains[j];
+        }
+    }
+    // sin(2π * normalizedAngle) の多項式近似 (normalizedAngle は [-0.5, 0.5])。誤差は 1e-7 程度
+    static double fastSin(double normalizedAngle) {
+        auto x = std::min(normalizedAngle, 0.5 - normalizedAngle);
+        x = std::max(x, -0.5 - normalizedAngle);
+        auto z = x * TWO_PI;
+        auto z2 = z * z;
+        return z * (1.0 + z2 * (-1.0 / 6 + z2 * (1.0 / 120 + z2 * (-1.0 / 5040 + z2 * (1.0 / 362880 +
+                                                                                     z2 * (-1.0 / 39916800))))));
+    }
+
+private:
+    // 有効なレーンだけを先頭に詰めた作業領域 (添字はレーン番号ではなく詰めた位置)
+    alignas(32) double phases[NUM_HARMONIC_LANES]{};
+    alignas(32) double ratios[NUM_HARMONIC_LANES]{};
+    alignas(32) double gains[NUM_HARMONIC_LANES]{};
+    alignas(32) double targetGains[NUM_HARMONIC_LANES]{};
+    alignas(32) double gainDeltas[NUM_HARMONIC_LANES]{};
+    // Recursive 用: 現在の位相 (cos, sin) と 1 サンプルあたりの回転量、周波数が動くときに回転量に掛ける量
+    alignas(32) double phasorRe[NUM_HARMONIC_LANES]{};
+    alignas(32) double phasorIm[NUM_HARMONIC_LANES]{};
+    alignas(32) double rotationRe[NUM_HARMONIC_LANES]{};
+    alignas(32) double rotationIm[NUM_HARMONIC_LANES]{};
+    alignas(32) double chirpRe[NUM_HARMONIC_LANES]{};
+    alignas(32) double chirpIm[NUM_HARMONIC_LANES]{};
+    int lanes[NUM_HARMONIC_LANES]{};  // 詰めた位置 -> レーン番号
+    int numActive = 0;
+    int numPadded = 0;  // ベクトル化しやすいよう numActive を 4 の倍数に切り上げたもの (余りはゲイン 0)
+    int mixWidth = 0;   // numActive 以上の最小の 2 の冪
+    // レーン番号で引く状態。止めているレーンの位相はここに退避しておく
+    double lanePhases[NUM_HARMONIC_LANES]{};
+    double lanePhasorRe[NUM_HARMONIC_LANES]{};
+    double lanePhasorIm[NUM_HARMONIC_LANES]{};
+    double laneGains[NUM_HARMONIC_LANES]{};
+    double laneTargetGains[NUM_HARMONIC_LANES]{};
+    int slots[NUM_HARMONIC_LANES]{};  // レーン番号 -> 詰めた位置
+    uint32_t activeLanes = (1u << NUM_HARMONIC_LANES) - 1;
+
+    double rotationFreq = 0.0;
+    HARMONIC_ENGINE engine = HARMONIC_ENGINE::Polynomial;
+    bool coherent = false;
+    double reciprocal_sampleRate = 0.0;
+    double pans[2]{std::cos(0.5 * HALF_PI), std::sin(0.5 * HALF_PI)};
+    double currentPan = 0.0;
+    void storeLanes() {
+        for (int j = 0; j < numActive; ++j) {
+            auto k = lanes[j];
+            lanePhases[k] = phases[j];
+            lanePhasorRe[k] = phasorRe[j];
+            lanePhasorIm[k] = phasorIm[j];
+        }
+    }
+    void loadLanes() {
+        numActive = 0;
+        for (int k = 0; k < NUM_HARMONIC_LANES; ++k) {
+            if (!(activeLanes & (1u << k))) {
+                continue;
+            }
+            auto j = numActive++;
+            lanes[j] = k;
+            slots[k] = j;
+            ratios[j] = k + 1;
+            gains[j] = laneGains[k];
+            targetGains[j] = laneTargetGains[k];
+            phases[j] = lanePhases[k];
+            phasorRe[j] = lanePhasorRe[k];
+            phasorIm[j] = lanePhasorIm[k];
+        }
+        numPadded = std::min((numActive + 3) & ~3, NUM_HARMONIC_LANES);
+        for (int j = numActive; j < NUM_HARMONIC_LANES; ++j) {
+            ratios[j] = 0.0;
+            gains[j] = 0.0;
+            targetGains[j] = 0.0;
+            phases[j] = 0.0;
+            phasorRe[j] = 1.0;
+            phasorIm[j] = 0.0;
+            rotationRe[j] = 1.0;
+            rotationIm[j] = 0.0;
+            chirpRe[j] = 1.0;
+            chirpIm[j] = 0.0;
+        }
+        for (mixWidth = 1; mixWidth < numActive; mixWidth *= 2) {
+        }
+        rotationFreq = 0.0;
+    }
+    void calcPan(double pan) {
+        if (pan != currentPan) {
+            jassert(pan >= -1);
+            jassert(pan <= 1);
+            double theta = (pan + 1) * 0.5 * HALF_PI;
+            pans[0] = std::cos(theta);
+            pans[1] = std::sin(theta);
+        }
+        currentPan = pan;
+    }
+    // FixedLanes が 0 でなければレーン数をコンパイル時に決めて、ループを展開させる
+    template <int FixedLanes, typename Sample>
+    void addBlockPolynomial(const double *freqs, Sample *outL, Sample *outR, int numSamples) {
+        alignas(32) double values[NUM_HARMONIC_LANES]{};
+        const auto numLanes = FixedLanes != 0 ? FixedLanes : numPadded;
+        for (int i = 0; i < numSamples; ++i) {
+            auto delta = freqs[i] * reciprocal_sampleRate;
+            for (int j = 0; j < numLanes; ++j) {
+                auto phase = phases[j] + delta * ratios[j];
+                phase -= (int)(phase + 0.5);  // [-0.5, 0.5) に収める
+                phases[j] = phase;
+                gains[j] += gainDeltas[j];
+                values[j] = fastSin(phase) * gains[j];
+            }
+            mix(values, outL[i], outR[i]);
+        }
+    }
+    // coherent の場合はレーン 0 (基音) が必ず先頭に入っている
+    template <typename Sample>
+    void addBlockPolynomialCoherent(const double *freqs, Sample *outL, Sample *outR, int numSamples) {
+        alignas(32) double values[NUM_HARMONIC_LANES]{};
+        const auto offset = NUM_HARMONIC_LANES * 0.5;  // 負の位相でも切り捨てで丸められるように下駄を履かせる
+        for (int i = 0; i < numSamples; ++i) {
+            auto fundamental = phases[0] + freqs[i] * reciprocal_sampleRate;
+            fundamental -= (int)(fundamental + 0.5);
+            for (int j = 0; j < numPadded; ++j) {
+                auto phase = fundamental * ratios[j];
+                phase = phase + offset - (int)(phase + offset + 0.5);
+                phases[j] = phase;
+                gains[j] += gainDeltas[j];
+                values[j] = fastSin(phase) * gains[j];
+            }
+            mix(values, outL[i], outR[i]);
+        }
+    }
+    // 回転量は 1 サンプルごとに chirp を掛けて進める (周波数が一定なら chirp は 1 なので変わらない)。
+    // 一定のときも同じループにしておくと、回転量をループの外でレジスタに載せようとして溢れることもない
+    template <int FixedLanes, typename Sample>
+    void addBlockRecursive(Sample *outL, Sample *outR, int numSamples) {
+        alignas(32) double values[NUM_HARMONIC_LANES]{};
+        const auto numLanes = FixedLanes != 0 ? FixedLanes : numPadded;
+        for (int i = 0; i < numSamples; ++i) {
+            for (int j = 0; j < numLanes; ++j) {
+                auto re = phasorRe[j] * rotationRe[j] - phasorIm[j] * rotationIm[j];
+                auto im = phasorRe[j] * rotationIm[j] + phasorIm[j] * rotationRe[j];
+                phasorRe[j] = re;
+                phasorIm[j] = im;
+                auto nextRe = rotationRe[j] * chirpRe[j] - rotationIm[j] * chirpIm[j];
+                rotationIm[j] = rotationRe[j] * chirpIm[j] + rotationIm[j] * chirpRe[j];
+                rotationRe[j] = nextRe;
+                gains[j] += gainDeltas[j];
+                values[j] = im * gains[j];
+            }
+            mix(values, outL[i], outR[i]);
+        }
+        // 丸め誤差で振幅がずれていくので、ブロックごとに大きさを 1 に戻す (1/sqrt(x) の 1 次近似)
+        for (int j = 0; j < numActive; ++j) {
+            auto scale = (3.0 - (phasorRe[j] * phasorRe[j] + phasorIm[j] * phasorIm[j])) * 0.5;
+            phasorRe[j] *= scale;
+            phasorIm[j] *= scale;
+        }
+    }
+    template <typename Sample>
+    void addBlockRecursiveCoherent(Sample *outL, Sample *outR, int numSamples) {
+        alignas(32) double values[NUM_HARMONIC_LANES]{};
+        double powerRe[NUM_HARMONIC_LANES];
+        double powerIm[NUM_HARMONIC_LANES];
+        auto numLanes = lanes[numActive - 1] + 1;
+        for (int i = 0; i < numSamples; ++i) {
+            auto baseRe = phasorRe[0] * rotationRe[0] - phasorIm[0] * rotationIm[0];
+            auto baseIm = phasorRe[0] * rotationIm[0] + phasorIm[0] * rotationRe[0];
+            auto nextRe = rotationRe[0] * chirpRe[0] - rotationIm[0] * chirpIm[0];
+            rotationIm[0] = rotationRe[0] * chirpIm[0] + rotationIm[0] * chirpRe[0];
+            rotationRe[0] = nextRe;
+            // k 倍音の位相は基音の位相の k 倍 (複素数の k 乗)
+            powerRe[0] = baseRe;
+            powerIm[0] = baseIm;
+            for (int k = 1; k < numLanes; ++k) {
+                powerRe[k] = powerRe[k - 1] * baseRe - powerIm[k - 1] * baseIm;
+                powerIm[k] = powerRe[k - 1] * baseIm + powerIm[k - 1] * baseRe;
+            }
+            for (int j = 0; j < numActive; ++j) {
+                phasorRe[j] = powerRe[lanes[j]];
+                phasorIm[j] = powerIm[lanes[j]];
+                gains[j] += gainDeltas[j];
+                values[j] = phasorIm[j] * gains[j];
+            }
+            mix(values, outL[i], outR[i]);
+        }
+        auto scale = (3.0 - (phasorRe[0] * phasorRe[0] + phasorIm[0] * phasorIm[0])) * 0.5;
+        phasorRe[0] *= scale;
+        phasorIm[0] *= scale;
+    }
+    // 区間の最初のサンプルの回転量と、1 サンプルごとに回転量に掛ける量 (chirp) を用意する。
+    // 三角関数は区間ごとに 1 回 (周波数が動くときは 2 回) で、区間の中では掛け算だけで回転量を進める
+    void prepareRotation(const double *freqs, int numSamples) {
+        auto first = freqs[0];
+        auto last = freqs[numSamples - 1];
+        if (first == last) {
+            if (first != rotationFreq) {
+                rotationFreq = first;
+                calcRotation(first, rotationRe, rotationIm);
+                std::fill_n(chirpRe, numActive, 1.0);
+                std::fill_n(chirpIm, numActive, 0.0);
+            }
+            return;
+        }
+        calcRotation(first, rotationRe, rotationIm);
+        calcRotation((last - first) / (numSamples - 1), chirpRe, chirpIm);
+        rotationFreq = 0.0;  // 区間の中で回転量を進めたので、次の区間では計算し直す
+    }
+    // 基音の回転量だけ三角関数で求め、k 倍音の回転量は複素数の掛け算で求める
+    void calcRotation(double freq, double *outRe, double *outIm) {
+        auto angle = TWO_PI * freq * reciprocal_sampleRate;
+        auto baseRe = std::cos(angle);
+        auto baseIm = std::sin(angle);
+        auto re = baseRe;
+        auto im = baseIm;
+        auto k = 0;
+        for (int j = 0; j < numActive; ++j) {
+            for (; k < lanes[j]; ++k) {
+                auto nextRe = re * baseRe - im * baseIm;
+                im = re * baseIm + im * baseRe;
+                re = nextRe;
+            }
+            outRe[j] = re;
+            outIm[j] = im;
+        }
+    }
+    // 足し込む順番を固定したままベクトル化できるように半分ずつ畳む
+    // (numActive 以降は 0 なので mixWidth より先を畳む必要は無く、畳んだ後も 0 のまま残る)
+    template <typename Sample>
+    void mix(double *values, Sample &outL, Sample &outR) {
+        for (int width = mixWidth / 2; width > 0; width /= 2) {
+            for (int k = 0; k < width; ++k) {
+                values[k] += values[k + width];
+            }
+        }
+        outL += values[0] * pans[0];
+        outR += values[0] * pans[1];
+    }
+};
+
+//==============================================================================
+template <typename T>
 class StereoDelay {
 public:
     StereoDelay() {}
     ~StereoDelay() { DBG("DelayEffect's destructor called."); }
     StereoDelay(const StereoDelay &) = delete;
+    // maxDelayTime 秒まで遅らせられるだけのメモリを確保する (オーディオスレッドの外で呼ぶこと)
+    void prepare(double sampleRate, double maxDelayTime) {
+        // 補間のために 1 サンプル余分に遡る
+        auto maxLength = std::max(1, (int)std::ceil(sampleRate * maxDelayTime)) + 1;
+        capacity = 1;
+        while (capacity < maxLength) {
+            capacity <<= 1;
+        }
+        // 範囲はここで決めておき、オーディオスレッドでは広げない (遅延を伸ばした時に読むのは本当の過去か無音)
+        for (auto &buffer : past) {
+            buffer.assign(capacity, 0.0f);
+        }
+        mask = capacity - 1;
+        cursor = 0;
+        for (int ch = 0; ch < 2; ch++) {
+            delay[ch] = targetDelay[ch] = 1.0;
+            delayDelta[ch] = 0.0;
+        }
+        smoothingRemaining = 0;
+        jumpToTarget = true;
+    }
+    // 遅延時間が変わった時は SMOOTHING_TIME 秒かけて線形に動かす (その間はテープのようにピッチが揺れる)
     void setParams(double sampleRate,
                    DELAY_TYPE type,
                    double delayTimeL,
@@ -685,45 +1768,152 @@ public:
                    double highFreq,
                    double feedback,
                    double mix) {
+        jassert(capacity > 0);
         lowpass.setSampleRate(sampleRate);
         highpass.setSampleRate(sampleRate);
-        delayLength[0] = std::max(1.0, std::min(192000.0, sampleRate * delayTimeL));
-        delayLength[1] = std::max(1.0, std::min(192000.0, sampleRate * delayTimeR));
+        lowpass.setParams(FILTER_TYPE::Lowpass, highFreq, 1.0, 0.0, 0);
+        highpass.setParams(FILTER_TYPE::Highpass, lowFreq, 1.0, 0.0, 0);
+        double target[2]{sampleRate * delayTimeL, sampleRate * delayTimeR};
+        for (int ch = 0; ch < 2; ch++) {
+            target[ch] = std::max(1.0, std::min(capacity - 1.0, target[ch]));
+        }
+        if (jumpToTarget) {
+            std::copy_n(target, 2, delay);
+            smoothingRemaining = 0;
+            jumpToTarget = false;
+        } else if (target[0] != targetDelay[0] || target[1] != targetDelay[1]) {
+            auto steps = std::max(1, (int)(sampleRate * SMOOTHING_TIME));
+            for (int ch = 0; ch < 2; ch++) {
+                delayDelta[ch] = (target[ch] - delay[ch]) / steps;
+            }
+            smoothingRemaining = steps;
+        }
+        std::copy_n(target, 2, targetDelay);
         this->type = type;
-        this->lowFreq = lowFreq;
-        this->highFreq = highFreq;
         this->feedback = feedback;
         this->mix = mix;
     }
-    void step(double *input) {
-        double tmp[2]{past[0][cursor[0]], past[1][cursor[1]]};  // loop の中で past を上書きするのでここに保持しておく
+    // L/R 1 サンプル分をその場で処理する
+    void step(T *input) {
+        T wet[2]{(T)read(0, cursor, delay[0]), (T)read(1, cursor, delay[1])};
+        T newWet[2];
         for (int ch = 0; ch < 2; ch++) {
             auto dry = input[ch];
-            auto wet = past[ch][cursor[ch]];
-            input[ch] = dry * (1 - mix) + wet * mix;
+            input[ch] = dry * (1 - mix) + wet[ch] * mix;
 
-            auto newWet = dry + tmp[type == DELAY_TYPE::PingPong ? 1 - ch : ch] * feedback;
-            newWet = lowpass.step(FILTER_TYPE::Lowpass, highFreq, 1.0, 0.0, ch, newWet);
-            newWet = highpass.step(FILTER_TYPE::Highpass, lowFreq, 1.0, 0.0, ch, newWet);
-            past[ch][cursor[ch]] = newWet;
+            newWet[ch] = dry + wet[type == DELAY_TYPE::PingPong ? 1 - ch : ch] * feedback;
         }
+        lowpass.step(newWet);
+        highpass.step(newWet);
         for (int ch = 0; ch < 2; ch++) {
-            cursor[ch]++;
-            if (cursor[ch] >= delayLength[ch]) {
-                cursor[ch] = 0;
+            past[ch][cursor] = newWet[ch];
+        }
+        cursor = (cursor + 1) & mask;
+        if (smoothingRemaining > 0) {
+            double nextDelay[2]{delay[0] + delayDelta[0], delay[1] + delayDelta[1]};
+            advanceSmoothing(1, nextDelay);
+        }
+    }
+    // L/R の numSamples サンプルをその場で処理する。
+    // 書き込みが回り込まず、読み出しがその区間で書いたところに届かない長さに区切って、区間ごとにまとめて処理する
+    void process(T *left, T *right, int numSamples) {
+        T *io[2]{left, right};
+        alignas(16) T wet[2][MAX_SEGMENT];
+        alignas(16) T newWet[2][MAX_SEGMENT];
+        double nextDelay[2];
+        Filter<T> *filters[2]{&lowpass, &highpass};
+        auto cross = type == DELAY_TYPE::PingPong;
+        for (int offset = 0; offset < numSamples;) {
+            auto length = std::min({numSamples - offset, mask + 1 - cursor, (int)MAX_SEGMENT});
+            if (smoothingRemaining > 0) {
+                length = std::min(length, smoothingRemaining);
+            }
+            for (int ch = 0; ch < 2; ch++) {
+                // 区間の中で遅延は線形に動くので、両端の短い方で抑えれば十分
+                auto shortest = std::min(delay[ch], delay[ch] + delayDelta[ch] * (length - 1));
+                length = std::min(length, smoothingRemaining > 0 ? (int)shortest : (int)delay[ch]);
+            }
+            // 遅延が一定なら読み出しも連続した区間になる (回り込む所で区切る)
+            auto contiguous = smoothingRemaining == 0;
+            for (int ch = 0; ch < 2 && contiguous; ch++) {
+                auto available = mask - ((cursor - (int)delay[ch] - 1) & mask);
+                if (available > 0) {
+                    length = std::min(length, available);
+                } else {
+                    contiguous = false;
+                }
             }
+            for (int ch = 0; ch < 2; ch++) {
+                if (contiguous) {
+                    auto whole = (int)delay[ch];
+                    auto fraction = (T)(delay[ch] - whole);
+                    const auto *older = &past[ch][(cursor - whole - 1) & mask];
+                    for (int i = 0; i < length; i++) {
+                        T newer = older[i + 1];
+                        wet[ch][i] = newer + (older[i] - newer) * fraction;
+                    }
+                } else {
+                    auto d = delay[ch];
+                    auto delta = smoothingRemaining > 0 ? delayDelta[ch] : 0.0;
+                    for (int i = 0; i < length; i++) {
+                        wet[ch][i] = read(ch, cursor + i, d);
+                        d += delta;
+                    }
+                    nextDelay[ch] = d;
+                }
+            }
+            for (int ch = 0; ch < 2; ch++) {
+                auto *x = io[ch] + offset;
+                auto *feedbackWet = wet[cross ? 1 - ch : ch];
+                for (int i = 0; i < length; i++) {
+                    auto dry = x[i];
+                    x[i] = dry * (1 - mix) + wet[ch][i] * mix;
+                    newWet[ch][i] = dry + feedbackWet[i] * feedback;
+                }
+            }
+            Filter<T>::processCascade(filters, 2, newWet[0], newWet[1], length);
+            for (int ch = 0; ch < 2; ch++) {
+                auto *dest = &past[ch][cursor];
+                for (int i = 0; i < length; i++) {
+                    dest[i] = newWet[ch][i];
+                }
+            }
+            cursor = (cursor + length) & mask;
+            if (smoothingRemaining > 0) {
+                advanceSmoothing(length, nextDelay);
+            }
+            offset += length;
         }
     }
 
 private:
-    float past[2][192000]{};
-    int delayLength[2]{1, 1};
-    int cursor[2]{};
-    Filter lowpass;
-    Filter highpass;
+    enum { MAX_SEGMENT = 64 };
+    static constexpr double SMOOTHING_TIME = 0.05;  // sec
+    // 書き込み位置は左右で共通。読み出しは delay サンプル手前から (小数部は線形補間)
+    std::vector<float> past[2];
+    int capacity = 0;
+    int mask = 0;
+    int cursor = 0;
+    double delay[2]{1.0, 1.0};
+    double targetDelay[2]{1.0, 1.0};
+    double delayDelta[2]{};
+    int smoothingRemaining = 0;
+    bool jumpToTarget = true;
+    Filter<T> lowpass;
+    Filter<T> highpass;
     DELAY_TYPE type = DELAY_TYPE::Parallel;
-    double lowFreq = 10;
-    double highFreq = 20000;
-    double feedback = 0;
-    double mix = 0;
+    T feedback = 0;
+    T mix = 0;
+    double read(int ch, int position, double delayInSamples) const {
+        auto whole = (int)delayInSamples;
+        auto fraction = delayInSamples - whole;
+        double newer = past[ch][(position - whole) & mask];
+        double older = past[ch][(position - whole - 1) & mask];
+        return newer + (older - newer) * fraction;
+    }
+    void advanceSmoothing(int numSamples, const double *nextDelay) {
+        smoothingRemaining -= numSamples;
+        // 誤差が溜まらないように最後は目標に揃える
+        std::copy_n(smoothingRemaining == 0 ? targetDelay : nextDelay, 2, delay);
+    }
 };
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <complex>
+#include <utility>
+#include <vector>
+
+#include "MathConstants.h"
+
+// JUCE に依存しないので、プラグイン以外 (テーブルの生成など) からも使える
+namespace fft {
+
+// 長さが 2 のべき乗の複素 FFT (radix-2, in-place)。
+// inverse なら x[n] = Σ X[k] e^{+2πikn/N} を計算する (1/N の正規化はしない)
+inline void transform(std::vector<std::complex<double>> &data, bool inverse) {
+    auto n = (int)data.size();
+    for (int i = 1, j = 0; i < n; ++i) {
+        auto bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            std::swap(data[i], data[j]);
+        }
+    }
+    auto sign = inverse ? 1.0 : -1.0;
+    for (int length = 2; length <= n; length <<= 1) {
+        auto angle = sign * math_constants::TWO_PI / length;
+        auto half = length / 2;
+        for (int k = 0; k < half; ++k) {
+            auto w = std::polar(1.0, angle * k);
+            for (int start = 0; start < n; start += length) {
+                auto &a = data[start + k];
+                auto &b = data[start + k + half];
+                auto t = b * w;
+                b = a - t;
+                a += t;
+            }
+        }
+    }
+}
+
+}  // namespace fft
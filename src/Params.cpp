@@ -53,13 +53,25 @@ VoiceParams::VoiceParams() {
     std::string namePrefix = "Voice ";
     PitchBendRange =
         new juce::AudioParameterInt(idPrefix + "PITCH_BEND_RANGE", namePrefix + "Pitch-Bend Range", 1, 12, 2);
+    Polyphony =
+        new juce::AudioParameterInt(idPrefix + "POLYPHONY", namePrefix + "Polyphony", 1, MAX_VOICES, MAX_VOICES);
+    RenderThreads = new juce::AudioParameterInt(
+        idPrefix + "RENDER_THREADS", namePrefix + "Render Threads", 0, MAX_RENDER_THREADS, 0);
+}
+void VoiceParams::addAllParameters(juce::AudioProcessor& processor) {
+    processor.addParameter(PitchBendRange);
+    processor.addParameter(Polyphony);
+    processor.addParameter(RenderThreads);
 }
-void VoiceParams::addAllParameters(juce::AudioProcessor& processor) { processor.addParameter(PitchBendRange); }
 void VoiceParams::saveParameters(juce::XmlElement& xml) {
     xml.setAttribute(PitchBendRange->paramID, PitchBendRange->get());
+    xml.setAttribute(Polyphony->paramID, Polyphony->get());
+    xml.setAttribute(RenderThreads->paramID, RenderThreads->get());
 }
 void VoiceParams::loadParameters(juce::XmlElement& xml) {
     *PitchBendRange = xml.getIntAttribute(PitchBendRange->paramID, 2);
+    *Polyphony = xml.getIntAttribute(Polyphony->paramID, MAX_VOICES);
+    *RenderThreads = xml.getIntAttribute(RenderThreads->paramID, 0);
 }
 
 //==============================================================================
@@ -171,9 +183,9 @@ DelayParams::DelayParams() {
     Type = new juce::AudioParameterChoice(
         idPrefix + "TYPE", namePrefix + "Type", DELAY_TYPE_NAMES, DELAY_TYPE_NAMES.indexOf("Parallel"));
     TimeL = new juce::AudioParameterFloat(
-        idPrefix + "TIME_L", namePrefix + "TimeL", rangeWithSkewForCentre(0.01f, 1.0f, 0.4f), 0.3f);
+        idPrefix + "TIME_L", namePrefix + "TimeL", rangeWithSkewForCentre(MIN_DELAY_TIME, MAX_DELAY_TIME, 0.4f), 0.3f);
     TimeR = new juce::AudioParameterFloat(
-        idPrefix + "TIME_R", namePrefix + "TimeR", rangeWithSkewForCentre(0.01f, 1.0f, 0.4f), 0.4f);
+        idPrefix + "TIME_R", namePrefix + "TimeR", rangeWithSkewForCentre(MIN_DELAY_TIME, MAX_DELAY_TIME, 0.4f), 0.4f);
     LowFreq = new juce::AudioParameterFloat(
         idPrefix + "LOW_FREQ", namePrefix + "LowFfreq", rangeWithSkewForCentre(10.0f, 20000.0f, 2000.0f), 10.0f);
     HighFreq = new juce::AudioParameterFloat(
@@ -12,12 +12,26 @@ public:
     virtual void addAllParameters(juce::AudioProcessor& processor) = 0;
     virtual void saveParameters(juce::XmlElement& xml) = 0;
     virtual void loadParameters(juce::XmlElement& xml) = 0;
+
+protected:
+    // freeze() 用。値が変わったときだけ true を返す
+    template <typename T>
+    static bool freezeValue(T& frozen, T value) {
+        if (frozen == value) {
+            return false;
+        }
+        frozen = value;
+        return true;
+    }
 };
 
 //==============================================================================
 class VoiceParams : public SynthParametersBase {
 public:
     juce::AudioParameterInt* PitchBendRange;
+    juce::AudioParameterInt* Polyphony;
+    // 音には関係しないので freeze() しない。ワーカーを作り直すのは次の prepareToPlay の時
+    juce::AudioParameterInt* RenderThreads;
 
     VoiceParams();
     VoiceParams(const VoiceParams&) = delete;
@@ -25,8 +39,14 @@ public:
     virtual void saveParameters(juce::XmlElement& xml) override;
     virtual void loadParameters(juce::XmlElement& xml) override;
 
-    int pitchBendRange;
-    void freeze() { pitchBendRange = PitchBendRange->get(); }
+    int pitchBendRange{};
+    int polyphony{};
+    bool freeze() {
+        auto changed = false;
+        changed |= freezeValue(pitchBendRange, PitchBendRange->get());
+        changed |= freezeValue(polyphony, Polyphony->get());
+        return changed;
+    }
 
 private:
 };
@@ -50,15 +70,17 @@ public:
     void setPanFromControl(double normalizedValue) { *Pan = Pan->range.convertFrom0to1(normalizedValue); }
     void setExpressionFromControl(double normalizedValue) { *Expression = normalizedValue; }
 
-    float pitch;
-    float pan;
-    float expression;
-    float midiVolume;
-    void freeze() {
-        pitch = Pitch->get();
-        pan = Pan->get();
-        expression = Expression->get();
-        midiVolume = MidiVolume->get();
+    float pitch{};
+    float pan{};
+    float expression{};
+    float midiVolume{};
+    bool freeze() {
+        auto changed = false;
+        changed |= freezeValue(pitch, Pitch->get());
+        changed |= freezeValue(pan, Pan->get());
+        changed |= freezeValue(expression, Expression->get());
+        changed |= freezeValue(midiVolume, MidiVolume->get());
+        return changed;
     }
 
 private:
@@ -79,11 +101,13 @@ public:
     virtual void saveParameters(juce::XmlElement& xml) override;
     virtual void loadParameters(juce::XmlElement& xml) override;
 
-    float pan;
-    float masterVolume;
-    void freeze() {
-        pan = Pan->get();
-        masterVolume = MasterVolume->get();
+    float pan{};
+    float masterVolume{};
+    bool freeze() {
+        auto changed = false;
+        changed |= freezeValue(pan, Pan->get());
+        changed |= freezeValue(masterVolume, MasterVolume->get());
+        return changed;
     }
 
 private:
@@ -102,9 +126,9 @@ public:
     virtual void saveParameters(juce::XmlElement& xml) override;
     virtual void loadParameters(juce::XmlElement& xml) override;
 
-    float gain;
+    float gain{};
 
-    void freeze() { gain = Gain->get(); }
+    bool freeze() { return freezeValue(gain, Gain->get()); }
 
 private:
     int index;
@@ -124,9 +148,9 @@ public:
     virtual void saveParameters(juce::XmlElement& xml) override;
     virtual void loadParameters(juce::XmlElement& xml) override;
 
-    float gain;
+    float gain{};
 
-    void freeze() { gain = Gain->get(); }
+    bool freeze() { return freezeValue(gain, Gain->get()); }
 
 private:
     NoiseParams(){};
@@ -148,15 +172,17 @@ public:
     virtual void saveParameters(juce::XmlElement& xml) override;
     virtual void loadParameters(juce::XmlElement& xml) override;
 
-    float attackCurve;
-    float attack;
-    float decay;
-    float release;
-    void freeze() {
-        attackCurve = AttackCurve->get();
-        attack = Attack->get();
-        decay = Decay->get();
-        release = Release->get();
+    float attackCurve{};
+    float attack{};
+    float decay{};
+    float release{};
+    bool freeze() {
+        auto changed = false;
+        changed |= freezeValue(attackCurve, AttackCurve->get());
+        changed |= freezeValue(attack, Attack->get());
+        changed |= freezeValue(decay, Decay->get());
+        changed |= freezeValue(release, Release->get());
+        return changed;
     }
 
 private:
@@ -197,21 +223,23 @@ public:
     }
     bool isFreqAbsolute() { return getFreqType() == FILTER_FREQ_TYPE::Absolute; }
 
-    bool enabled;
-    FILTER_TYPE type;
-    bool isFreqAbsoluteFreezed;
-    float hz;
-    int semitone;
-    float q;
-    float gain;
-    void freeze() {
-        enabled = Enabled->get();
-        type = getType();
-        isFreqAbsoluteFreezed = isFreqAbsolute();
-        hz = Hz->get();
-        semitone = Semitone->get();
-        q = Q->get();
-        gain = Gain->get();
+    bool enabled{};
+    FILTER_TYPE type{};
+    bool isFreqAbsoluteFreezed{};
+    float hz{};
+    int semitone{};
+    float q{};
+    float gain{};
+    bool freeze() {
+        auto changed = false;
+        changed |= freezeValue(enabled, Enabled->get());
+        changed |= freezeValue(type, getType());
+        changed |= freezeValue(isFreqAbsoluteFreezed, isFreqAbsolute());
+        changed |= freezeValue(hz, Hz->get());
+        changed |= freezeValue(semitone, Semitone->get());
+        changed |= freezeValue(q, Q->get());
+        changed |= freezeValue(gain, Gain->get());
+        return changed;
     }
 
 private:
@@ -239,23 +267,25 @@ public:
 
     DELAY_TYPE getType() { return static_cast<DELAY_TYPE>(Type->getIndex()); }
 
-    bool enabled;
-    DELAY_TYPE type;
-    float timeL;
-    float timeR;
-    float lowFreq;
-    float highFreq;
-    float feedback;
-    float mix;
-    void freeze() {
-        enabled = Enabled->get();
-        type = getType();
-        timeL = TimeL->get();
-        timeR = TimeR->get();
-        lowFreq = LowFreq->get();
-        highFreq = HighFreq->get();
-        feedback = Feedback->get();
-        mix = Mix->get();
+    bool enabled{};
+    DELAY_TYPE type{};
+    float timeL{};
+    float timeR{};
+    float lowFreq{};
+    float highFreq{};
+    float feedback{};
+    float mix{};
+    bool freeze() {
+        auto changed = false;
+        changed |= freezeValue(enabled, Enabled->get());
+        changed |= freezeValue(type, getType());
+        changed |= freezeValue(timeL, TimeL->get());
+        changed |= freezeValue(timeR, TimeR->get());
+        changed |= freezeValue(lowFreq, LowFreq->get());
+        changed |= freezeValue(highFreq, HighFreq->get());
+        changed |= freezeValue(feedback, Feedback->get());
+        changed |= freezeValue(mix, Mix->get());
+        return changed;
     }
 
 private:
@@ -280,17 +310,19 @@ public:
     virtual void loadParameters(juce::XmlElement& xml) override;
 
     int index;
-    int noteNumber;
-    void freeze() {
-        noteNumber = NoteNumber->get();
+    int noteNumber{};
+    bool freeze() {
+        auto changed = false;
+        changed |= freezeValue(noteNumber, NoteNumber->get());
         for (int i = 0; i < NUM_OSC; ++i) {
-            oscParams[i].freeze();
-            envelopeParams[i].freeze();
+            changed |= oscParams[i].freeze();
+            changed |= envelopeParams[i].freeze();
         }
         for (int i = 0; i < NUM_NOISE; ++i) {
-            noiseParams[i].freeze();
-            noiseEnvelopeParams[i].freeze();
+            changed |= noiseParams[i].freeze();
+            changed |= noiseEnvelopeParams[i].freeze();
         }
+        return changed;
     }
 };
 
@@ -311,13 +343,15 @@ public:
     WAVEFORM getWaveForm() { return NOISE_WAVEFORM_VALUES[Waveform->getIndex()]; }
 
     int index;
-    WAVEFORM waveform;
+    WAVEFORM waveform{};
 
-    void freeze() {
-        waveform = getWaveForm();
+    bool freeze() {
+        auto changed = false;
+        changed |= freezeValue(waveform, getWaveForm());
         for (auto& params : filterParams) {
-            params.freeze();
+            changed |= params.freeze();
         }
+        return changed;
     }
 };
 
@@ -356,13 +390,19 @@ public:
 
     bool harmonicMute[NUM_OSC]{};
     bool noiseMute[NUM_NOISE]{};
-    void freeze() {
+    bool freeze() {
+        auto changed = false;
         for (int i = 0; i < NUM_OSC; i++) {
-            harmonicMute[i] = isMute(false, i);
+            auto mute = isMute(false, i);
+            changed |= harmonicMute[i] != mute;
+            harmonicMute[i] = mute;
         }
         for (int i = 0; i < NUM_NOISE; i++) {
-            noiseMute[i] = isMute(true, i);
+            auto mute = isMute(true, i);
+            changed |= noiseMute[i] != mute;
+            noiseMute[i] = mute;
         }
+        return changed;
     }
 
 private:
@@ -393,6 +433,11 @@ struct CalculatedParams {
     double decay[NUM_OSC]{};
     double release[NUM_OSC]{};
 };
+struct NoteParams {
+    CalculatedParams params;
+    CalculatedParams noiseParams;
+    uint64_t generation = 0;
+};
 
 //==============================================================================
 class AllParams : public SynthParametersBase {
@@ -413,21 +458,42 @@ public:
     virtual void saveParameters(juce::XmlElement& xml) override;
     virtual void loadParameters(juce::XmlElement& xml) override;
 
-    void freeze() {
-        globalParams.freeze();
-        voiceParams.freeze();
+    bool freeze() {
+        auto mainChanged = false;
         for (auto& params : mainParams) {
-            params.freeze();
+            mainChanged |= params.freeze();
+        }
+        // ノートごとのパラメータは mainParams からしか計算しないので、ディレイやマスターなどの
+        // オートメーションではキャッシュを捨てないよう、世代は mainParams が変わった時だけ進める
+        if (mainChanged) {
+            generation++;
         }
+        auto changed = mainChanged;
+        changed |= globalParams.freeze();
+        changed |= voiceParams.freeze();
         for (auto& params : noiseUnitParams) {
-            params.freeze();
+            changed |= params.freeze();
         }
-        delayParams.freeze();
-        masterParams.freeze();
-        soloMuteParams.freeze();
+        changed |= delayParams.freeze();
+        changed |= masterParams.freeze();
+        changed |= soloMuteParams.freeze();
+        return changed;
     }
+    // mainParams の値が変わった freeze() の回数。これが変わらない限り getNoteParams() の結果も変わらない
+    uint64_t getGeneration() { return generation; }
     MainParams& getCurrentMainParams() { return mainParams[editingTimbreIndex]; }
     void calculateIntermediateParams(CalculatedParams& params, CalculatedParams& noiseParams, int noteNumber);
+    // ノート番号ごとの補間済みパラメータ。世代が変わっていたら計算し直す (オーディオスレッド専用)
+    const NoteParams& getNoteParams(int noteNumber) {
+        auto& noteParams = noteParamsCache[noteNumber];
+        if (noteParams.generation != generation) {
+            calculateIntermediateParams(noteParams.params, noteParams.noiseParams, noteNumber);
+            noteParams.generation = generation;
+        }
+        return noteParams;
+    }
 
 private:
+    uint64_t generation = 1;
+    std::array<NoteParams, 128> noteParamsCache{};
 };
\ No newline at end of file
@@ -16,7 +16,11 @@ BerryAudioProcessorEditor::BerryAudioProcessorEditor(BerryAudioProcessor &p)
       voiceComponent{SectionComponent{"VOICE", HEADER_CHECK::Hidden, std::make_unique<VoiceComponent>(p.allParams)}},
       analyserToggle(&analyserMode),
       analyserWindow(&analyserMode, &p.latestDataProvider),
-      statusComponent(&p.polyphony, &p.timeConsumptionState, &p.latestDataProvider),
+      statusComponent(&p.polyphony,
+                      p.allParams.voiceParams.Polyphony,
+                      &p.renderTimeStats,
+                      &p.profileStats,
+                      &p.latestDataProvider),
       utilComponent{SectionComponent{"UTILITY", HEADER_CHECK::Hidden, std::make_unique<UtilComponent>(p)}},
       timbreComponent{
           SectionComponent{"TIMBRE",
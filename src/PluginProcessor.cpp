@@ -1,9 +1,16 @@
 #include "PluginProcessor.h"
 
 #include "Params.h"
-#include "PluginEditor.h"
 #include "Voice.h"
 
+// berry-render のようにエディタのソースをリンクせず、プロセッサだけを使うときは 1 にする
+#ifndef BERRY_HEADLESS
+#define BERRY_HEADLESS 0
+#endif
+#if !BERRY_HEADLESS
+#include "PluginEditor.h"
+#endif
+
 //==============================================================================
 BerryAudioProcessor::BerryAudioProcessor()
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -80,7 +87,17 @@ void BerryAudioProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
     std::cout << "sampleRate: " << sampleRate << std::endl;
     std::cout << "totalNumInputChannels: " << getTotalNumInputChannels() << std::endl;
     std::cout << "totalNumOutputChannels: " << getTotalNumOutputChannels() << std::endl;
+    // ボイスはここで最大数まで作っておき、オーディオスレッドでは確保しない (発音数は Polyphony で制限する)
+    if (synth.getNumVoices() != MAX_VOICES) {
+        synth.clearVoices();
+        for (auto i = 0; i < MAX_VOICES; ++i) {
+            auto *voice = new BerryVoice(this->buffer, allParams);
+            voice->setNoiseSeed(i);
+            synth.addVoice(voice);
+        }
+    }
     synth.setCurrentPlaybackSampleRate(sampleRate);
+    synth.prepareParallelRendering(allParams.voiceParams.RenderThreads->get(), samplesPerBlock);
     midiCollector.reset(sampleRate);
 }
 
@@ -114,13 +131,6 @@ void BerryAudioProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::M
     auto busCount = getBusCount(false);
     buffer.clear();
 
-    int numVoices = 64;
-    if (synth.getNumVoices() != numVoices) {
-        synth.clearVoices();
-        for (auto i = 0; i < numVoices; ++i) {
-            synth.addVoice(new BerryVoice(this->buffer, allParams));
-        }
-    }
     auto numSamples = buffer.getNumSamples();
 
     MidiBuffer incomingMidi;
@@ -131,7 +141,6 @@ void BerryAudioProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::M
     double startMillis = juce::Time::getMillisecondCounterHiRes();
     synth.renderNextBlock(buffer, midiMessages, 0, numSamples);  // don't upcast
     double endMillis = juce::Time::getMillisecondCounterHiRes();
-    timeConsumptionState.push(getSampleRate(), numSamples, (endMillis - startMillis) / 1000);
 
     polyphony = 0;
     for (auto i = 0; i < synth.getNumVoices(); ++i) {
@@ -139,6 +148,10 @@ void BerryAudioProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::M
             polyphony++;
         }
     }
+    renderTimeStats.push(getSampleRate(), numSamples, (endMillis - startMillis) / 1000, polyphony);
+#if BERRY_PROFILE
+    profileStats.push(getSampleRate(), numSamples, takeThreadProfileTicks());
+#endif
     latestDataProvider.push(buffer);
 
     midiMessages.clear();
@@ -155,9 +168,15 @@ void BerryAudioProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::M
 }
 
 //==============================================================================
+#if BERRY_HEADLESS
+bool BerryAudioProcessor::hasEditor() const { return false; }
+
+juce::AudioProcessorEditor* BerryAudioProcessor::createEditor() { return nullptr; }
+#else
 bool BerryAudioProcessor::hasEditor() const { return true; }
 
 juce::AudioProcessorEditor* BerryAudioProcessor::createEditor() { return new BerryAudioProcessorEditor(*this); }
+#endif
 
 //==============================================================================
 void BerryAudioProcessor::getStateInformation(juce::MemoryBlock& destData) {
@@ -189,4 +208,25 @@ void BerryAudioProcessor::pasteFromClipboard() {
     if (xml && xml->hasTagName("BerryInstrumentClipboard")) {
         allParams.loadParameters(*xml);
     }
+}
+void BerryAudioProcessor::copyRenderTimeStatsToClipboard() {
+    auto csv = renderStatsToCsv();
+    if (!csv.empty()) {
+        juce::SystemClipboard::copyTextToClipboard(csv);
+    }
+}
+std::string BerryAudioProcessor::renderStatsToCsv() {
+    RenderTimeStats::Snapshot snapshot;
+    if (!renderTimeStats.snapshot(snapshot)) {
+        return {};
+    }
+    auto csv = snapshot.toCsv();
+#if BERRY_PROFILE
+    ProfileStats::Snapshot profile;
+    if (!profileStats.snapshot(profile)) {
+        return {};
+    }
+    csv += "\n" + profile.toCsv();
+#endif
+    return csv;
 }
\ No newline at end of file
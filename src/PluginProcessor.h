@@ -2,39 +2,151 @@
 
 #include <JuceHeader.h>
 
+#include <sstream>
+
 #include "Params.h"
 #include "Voice.h"
 
 //==============================================================================
-class TimeConsumptionState {
+/*
+  1 ブロックの描画にかかった時間を、締め切り (numSamples / sampleRate) に対する割合 (負荷) で記録する。
+  平均すると音切れの原因になる一瞬のスパイクが見えなくなるので、対数の間隔のヒストグラムに数え、
+  締め切りを過ぎた回数と、負荷の大きかったブロックをその時の発音数と一緒に残しておく。
+  書き込むのはオーディオスレッドだけで、ロックもメモリ確保もしない。
+  読み出し側 (GUI など) は snapshot() でコピーを取り、書き込みと重なったらそのコピーは捨てる。
+*/
+class RenderTimeStats {
 public:
-    float currentTimeConsumptionRate = 0.0f;
-
-    TimeConsumptionState(){};
-    ~TimeConsumptionState(){};
-    void push(double sampleRate, int numSamples, double seconds) {
-        if (currentSampleRate != sampleRate) {
-            totalNumSamples = 0;
-            totalSeconds = 0.0f;
+    enum { binsPerDecade = 32, numBins = binsPerDecade * 4, numWorstBlocks = 8 };
+    static constexpr double minLoad = 0.001;  // 0 番目のビンの下端 (これより小さいものも 0 番目に数える)
+
+    struct WorstBlock {
+        double load;
+        int numSamples;
+        int polyphony;
+        uint64_t blockIndex;  // reset() してから何ブロック目か
+    };
+    struct Snapshot {
+        uint64_t numBlocks = 0;
+        uint64_t numDeadlineMisses = 0;
+        uint64_t bins[numBins]{};
+        WorstBlock worstBlocks[numWorstBlocks]{};  // 負荷の大きい順
+        // p (0 ~ 1) 分位の負荷。ビンの上端を返すので 1 割弱大きめになる。ブロックが無ければ 0
+        double percentile(double p) const {
+            if (numBlocks == 0) {
+                return 0.0;
+            }
+            auto rank = std::max<uint64_t>(1, (uint64_t)std::ceil(p * numBlocks));
+            uint64_t count = 0;
+            for (int i = 0; i < numBins; ++i) {
+                count += bins[i];
+                if (count >= rank) {
+                    return binUpperEdge(i);
+                }
+            }
+            return binUpperEdge(numBins - 1);
         }
-        currentSampleRate = sampleRate;
-        totalNumSamples += numSamples;
-        totalSeconds += seconds;
-        if (totalNumSamples > currentSampleRate) {
-            auto timeLimitPerSample = 1.0 / currentSampleRate;
-            currentTimeConsumptionRate = totalSeconds / totalNumSamples / timeLimitPerSample;
-            totalNumSamples = 0;
-            totalSeconds = 0.0f;
+        // previous から後の分だけの分布 (直近の区間を見るとき用)。worstBlocks は reset() してからのまま
+        Snapshot since(const Snapshot &previous) const {
+            Snapshot diff = *this;
+            if (previous.numBlocks > numBlocks) {
+                return diff;  // 間で reset() された
+            }
+            diff.numBlocks -= previous.numBlocks;
+            diff.numDeadlineMisses -= previous.numDeadlineMisses;
+            for (int i = 0; i < numBins; ++i) {
+                diff.bins[i] -= previous.bins[i];
+            }
+            return diff;
         }
+        // オフラインで見るための CSV。集計、ヒストグラム、負荷の大きかったブロックの順に並べる
+        std::string toCsv() const {
+            std::ostringstream ss;
+            ss << "blocks," << numBlocks << "\n";
+            ss << "deadline_misses," << numDeadlineMisses << "\n";
+            ss << "p50," << percentile(0.5) << "\n";
+            ss << "p99," << percentile(0.99) << "\n";
+            ss << "max," << worstBlocks[0].load << "\n";
+            ss << "\nload_upper_edge,count\n";
+            for (int i = 0; i < numBins; ++i) {
+                ss << binUpperEdge(i) << "," << bins[i] << "\n";
+            }
+            ss << "\nload,num_samples,polyphony,block_index\n";
+            for (auto &block : worstBlocks) {
+                if (block.numSamples > 0) {
+                    ss << block.load << "," << block.numSamples << "," << block.polyphony << "," << block.blockIndex
+                       << "\n";
+                }
+            }
+            return ss.str();
+        }
+    };
+
+    RenderTimeStats(){};
+    ~RenderTimeStats(){};
+    RenderTimeStats(const RenderTimeStats &) = delete;
+    static double binUpperEdge(int bin) { return minLoad * std::pow(10.0, (double)(bin + 1) / binsPerDecade); }
+    // オーディオスレッドから呼ぶ
+    void push(double sampleRate, int numSamples, double seconds, int polyphony) {
+        if (sampleRate <= 0 || numSamples <= 0) {
+            return;
+        }
+        auto load = seconds * sampleRate / numSamples;
+        auto bin = (int)std::floor(std::log10(std::max(load, minLoad) / minLoad) * binsPerDecade);
+        bin = std::min(bin, numBins - 1);
+
+        auto s = sequence.load(std::memory_order_relaxed);
+        sequence.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        if (resetRequested.exchange(false, std::memory_order_acquire)) {
+            data = Snapshot{};
+        }
+        auto blockIndex = data.numBlocks++;
+        data.bins[bin]++;
+        if (load > 1.0) {
+            data.numDeadlineMisses++;
+        }
+        // 負荷の大きい順に並べたまま、小さいものを押し出す
+        auto &worstBlocks = data.worstBlocks;
+        if (load > worstBlocks[numWorstBlocks - 1].load) {
+            int i = numWorstBlocks - 1;
+            for (; i > 0 && worstBlocks[i - 1].load < load; --i) {
+                worstBlocks[i] = worstBlocks[i - 1];
+            }
+            worstBlocks[i] = {load, numSamples, polyphony, blockIndex};
+        }
+        sequence.store(s + 2, std::memory_order_release);
+    }
+    // どのスレッドからでも呼べる。書き込みと重なり続けたら false を返す (out の中身は使えない)
+    bool snapshot(Snapshot &out) const {
+        for (int retry = 0; retry < 4; ++retry) {
+            auto before = sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue;
+            }
+            memcpy(&out, &data, sizeof(Snapshot));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == before) {
+                return true;
+            }
+        }
+        return false;
     }
+    // 次の push() で全て消す
+    void reset() { resetRequested.store(true, std::memory_order_release); }
 
 private:
-    double currentSampleRate = 0.0;
-    int totalNumSamples = 0;
-    double totalSeconds = 0.0;
+    std::atomic<uint64_t> sequence{0};  // 書き込み中は奇数
+    std::atomic<bool> resetRequested{false};
+    Snapshot data;
 };
 
 //==============================================================================
+/*
+  オーディオスレッドから GUI へ最新の波形を渡すためのリングバッファ。
+  書き込み側 (オーディオスレッド) は 1 つだけで、memcpy してから書き込んだ総サンプル数を公開するだけなのでロックしない。
+  読み出し側は各自のスレッドから pull() し、コピー中に上書きされていたらそのフレームは捨てる。
+*/
 class LatestDataProvider {
 public:
     class Consumer {
@@ -43,54 +155,67 @@ public:
         float *destinationR;
         int numSamples = 0;
         bool ready = false;
+        uint64_t lastSequence = 0;
     };
     enum { numSamples = 2048 };
-    std::vector<Consumer *> consumers{};
 
     LatestDataProvider(){};
     ~LatestDataProvider(){};
-    void addConsumer(Consumer *c) {
-        std::lock_guard<std::mutex> lock(mtx);
-        jassert(c->numSamples <= numSamples);
-        consumers.push_back(c);
-    }
-    void removeConsumer(Consumer *c) {
-        std::lock_guard<std::mutex> lock(mtx);
-        consumers.erase(remove(consumers.begin(), consumers.end(), c), consumers.end());
-    }
     void push(juce::AudioBuffer<float> &buffer) {
         if (buffer.getNumChannels() <= 0) {
             return;
         }
-        std::lock_guard<std::mutex> lock(mtx);
         auto *dataL = buffer.getReadPointer(0);
-        auto *dataR = buffer.getReadPointer(1);
-        for (auto i = 0; i < buffer.getNumSamples(); ++i) {
-            fifoL[fifoIndex] = dataL[i];
-            fifoR[fifoIndex] = dataR[i];
-            fifoIndex++;
-            for (auto *consumer : consumers) {
-                if (!consumer->ready && fifoIndex >= consumer->numSamples) {
-                    memcpy(consumer->destinationL,
-                           fifoL + fifoIndex - consumer->numSamples,
-                           sizeof(float) * consumer->numSamples);
-                    memcpy(consumer->destinationR,
-                           fifoR + fifoIndex - consumer->numSamples,
-                           sizeof(float) * consumer->numSamples);
-                    consumer->ready = true;
-                }
-            }
-            if (fifoIndex >= numSamples) {
-                fifoIndex = 0;
-            }
+        auto *dataR = buffer.getReadPointer(std::min(1, buffer.getNumChannels() - 1));
+        auto length = buffer.getNumSamples();
+        if (length > capacity) {
+            dataL += length - capacity;
+            dataR += length - capacity;
+            length = capacity;
+        }
+        auto sequence = writtenSamples.load(std::memory_order_relaxed);
+        // 書き換える範囲を先に知らせておく (pull() はコピーした後にこれを見て、重なっていれば捨てる)
+        writingSamples.store(sequence + length, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        auto start = (int)(sequence & mask);
+        auto firstLength = std::min(length, capacity - start);
+        memcpy(ringL + start, dataL, sizeof(float) * firstLength);
+        memcpy(ringR + start, dataR, sizeof(float) * firstLength);
+        memcpy(ringL, dataL + firstLength, sizeof(float) * (length - firstLength));
+        memcpy(ringR, dataR + firstLength, sizeof(float) * (length - firstLength));
+        writtenSamples.store(sequence + length, std::memory_order_release);
+    }
+    // 前回から新しいデータが書き込まれていれば最新の numSamples 個をコピーして ready にする
+    bool pull(Consumer &c) {
+        jassert(c.numSamples <= numSamples);
+        auto end = writtenSamples.load(std::memory_order_acquire);
+        if (end == c.lastSequence) {
+            return false;
+        }
+        auto begin = end - c.numSamples;
+        auto start = (int)(begin & mask);
+        auto firstLength = std::min(c.numSamples, capacity - start);
+        memcpy(c.destinationL, ringL + start, sizeof(float) * firstLength);
+        memcpy(c.destinationR, ringR + start, sizeof(float) * firstLength);
+        memcpy(c.destinationL + firstLength, ringL, sizeof(float) * (c.numSamples - firstLength));
+        memcpy(c.destinationR + firstLength, ringR, sizeof(float) * (c.numSamples - firstLength));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (writingSamples.load(std::memory_order_relaxed) - begin > (uint64_t)capacity) {
+            return false;  // コピー中に追い越された (書き込みの途中だったものも含む)
         }
+        c.lastSequence = end;
+        c.ready = true;
+        return true;
     }
 
 private:
-    float fifoL[numSamples]{};
-    float fifoR[numSamples]{};
-    int fifoIndex = 0;
-    std::mutex mtx;
+    // 読み出し中に書き込みが追いつかないよう、取り出す長さより十分大きくしておく
+    enum { capacity = numSamples * 4, mask = capacity - 1 };
+    static_assert((capacity & mask) == 0, "capacity must be a power of two");
+    float ringL[capacity]{};
+    float ringR[capacity]{};
+    std::atomic<uint64_t> writtenSamples{0};  // ここまで書き終わった
+    std::atomic<uint64_t> writingSamples{0};  // ここまで書いている途中 (writtenSamples 以上)
 };
 
 //==============================================================================
@@ -136,13 +261,17 @@ public:
     //==============================================================================
     void copyToClipboard();
     void pasteFromClipboard();
+    void copyRenderTimeStatsToClipboard();
+    // renderTimeStats (BERRY_PROFILE なら profileStats も) を CSV にする。書き込みと重なって読めなければ空
+    std::string renderStatsToCsv();
 
     //==============================================================================
     int currentProgram = 0;
     juce::MidiKeyboardState keyboardState;
     LatestDataProvider latestDataProvider;
     int polyphony = 0;
-    TimeConsumptionState timeConsumptionState;
+    RenderTimeStats renderTimeStats;
+    ProfileStats profileStats;  // BERRY_PROFILE が 0 なら何も入らない
 
     double startTime;
     AllParams allParams;
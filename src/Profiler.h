@@ -0,0 +1,200 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <atomic>
+#include <chrono>
+#include <sstream>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+// 描画の段ごとにかかった時間を測る。BERRY_PROFILE を 1 にしてビルドした時だけ計測する。
+// 0 (既定) なら BERRY_PROFILE_ZONE は何も展開されないので、ホットパスには何も残らない
+#ifndef BERRY_PROFILE
+#define BERRY_PROFILE 0
+#endif
+
+namespace {
+enum class PROFILE_ZONE { Envelope, Osc, Noise, NoiseFilter, Delay, Mix };
+const int NUM_PROFILE_ZONES = 6;
+const juce::StringArray PROFILE_ZONE_NAMES =
+    juce::StringArray("Envelope", "Osc", "Noise", "Noise Filter", "Delay", "Mix");
+}  // namespace
+
+// x86 ではタイムスタンプカウンタ、それ以外では steady_clock の値。単位は ProfileStats が実時間と比べて換算する
+inline uint64_t readProfileTicks() {
+#if defined(__x86_64__) || defined(_M_X64)
+    return __rdtsc();
+#else
+    return (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+//==============================================================================
+// スレッドごとの積算。ゾーンを抜けるたびにここへ足し、ブロックの終わりに takeThreadProfileTicks() で取り出す
+struct ProfileTicks {
+    uint64_t ticks[NUM_PROFILE_ZONES]{};
+    void add(const ProfileTicks &other) {
+        for (int i = 0; i < NUM_PROFILE_ZONES; ++i) {
+            ticks[i] += other.ticks[i];
+        }
+    }
+};
+struct ProfileSlot {
+    ProfileTicks total;
+    int currentZone = -1;  // 今いるゾーン (どこにもいなければ -1)
+    uint64_t since = 0;    // currentZone に入った (または戻った) 時刻
+};
+inline ProfileSlot &threadProfileSlot() {
+    static thread_local ProfileSlot slot;
+    return slot;
+}
+inline ProfileTicks takeThreadProfileTicks() {
+    auto &slot = threadProfileSlot();
+    auto ticks = slot.total;
+    slot.total = ProfileTicks{};
+    return ticks;
+}
+
+//==============================================================================
+/*
+  スコープの間の時間をそのスレッドの積算に足す。入れ子にすると内側の時間は外側から除く
+  (切り替わるたびに時刻を 1 回読むだけなので、ゾーンを細かく置いても計測の分はあまり増えない)。
+  直接使わず BERRY_PROFILE_ZONE(Osc); のように書く
+*/
+class ProfileZone {
+public:
+    ProfileZone(PROFILE_ZONE zone) : slot(threadProfileSlot()), parentZone(slot.currentZone) {
+        auto now = readProfileTicks();
+        if (parentZone >= 0) {
+            slot.total.ticks[parentZone] += now - slot.since;
+        }
+        slot.currentZone = (int)zone;
+        slot.since = now;
+    }
+    ~ProfileZone() {
+        auto now = readProfileTicks();
+        slot.total.ticks[slot.currentZone] += now - slot.since;
+        slot.currentZone = parentZone;
+        slot.since = now;
+    }
+    ProfileZone(const ProfileZone &) = delete;
+
+private:
+    ProfileSlot &slot;
+    int parentZone;
+};
+
+#if BERRY_PROFILE
+#define BERRY_PROFILE_CONCAT_(a, b) a##b
+#define BERRY_PROFILE_CONCAT(a, b) BERRY_PROFILE_CONCAT_(a, b)
+#define BERRY_PROFILE_ZONE(zone) ProfileZone BERRY_PROFILE_CONCAT(profileZone, __LINE__)(PROFILE_ZONE::zone)
+#else
+#define BERRY_PROFILE_ZONE(zone)
+#endif
+
+//==============================================================================
+/*
+  ブロックごとに集めた段ごとの時間を reset() してから積算する。
+  時刻の単位はブロックを push() した時の実時間と比べて秒に換算する。
+  RenderTimeStats と同じく書き込むのはオーディオスレッドだけで、読み出し側は snapshot() でコピーを取る。
+*/
+class ProfileStats {
+public:
+    struct Snapshot {
+        uint64_t numBlocks = 0;
+        double audioSeconds = 0.0;  // 描画した音の長さ
+        ProfileTicks ticks;
+        double ticksPerSecond = 0.0;  // まだ換算できなければ 0
+        double seconds(PROFILE_ZONE zone) const {
+            return ticksPerSecond > 0 ? ticks.ticks[(int)zone] / ticksPerSecond : 0.0;
+        }
+        // 音の長さに対する、その段にかかった CPU 時間の割合。並列に描画した分は足し合わせるので 1 を超えることもある
+        double load(PROFILE_ZONE zone) const { return audioSeconds > 0 ? seconds(zone) / audioSeconds : 0.0; }
+        // previous から後の分だけ (直近の区間を見るとき用)
+        Snapshot since(const Snapshot &previous) const {
+            Snapshot diff = *this;
+            if (previous.numBlocks > numBlocks) {
+                return diff;  // 間で reset() された
+            }
+            diff.numBlocks -= previous.numBlocks;
+            diff.audioSeconds -= previous.audioSeconds;
+            for (int i = 0; i < NUM_PROFILE_ZONES; ++i) {
+                diff.ticks.ticks[i] -= previous.ticks.ticks[i];
+            }
+            return diff;
+        }
+        std::string toCsv() const {
+            std::ostringstream ss;
+            ss << "audio_seconds," << audioSeconds << "\n";
+            ss << "\nzone,seconds,load\n";
+            for (int i = 0; i < NUM_PROFILE_ZONES; ++i) {
+                auto zone = (PROFILE_ZONE)i;
+                ss << PROFILE_ZONE_NAMES[i] << "," << seconds(zone) << "," << load(zone) << "\n";
+            }
+            return ss.str();
+        }
+    };
+
+    ProfileStats(){};
+    ~ProfileStats(){};
+    ProfileStats(const ProfileStats &) = delete;
+    // オーディオスレッドから呼ぶ
+    void push(double sampleRate, int numSamples, const ProfileTicks &block) {
+        if (sampleRate <= 0 || numSamples <= 0) {
+            return;
+        }
+        auto nowTicks = readProfileTicks();
+        auto now = std::chrono::steady_clock::now();
+
+        auto s = sequence.load(std::memory_order_relaxed);
+        sequence.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        if (resetRequested.exchange(false, std::memory_order_acquire)) {
+            data = Snapshot{};
+        }
+        if (data.numBlocks == 0) {
+            startTicks = nowTicks;
+            startTime = now;
+        } else {
+            auto elapsed = std::chrono::duration<double>(now - startTime).count();
+            if (elapsed > 0) {
+                data.ticksPerSecond = (nowTicks - startTicks) / elapsed;
+            }
+        }
+        data.numBlocks++;
+        data.audioSeconds += numSamples / sampleRate;
+        data.ticks.add(block);
+        sequence.store(s + 2, std::memory_order_release);
+    }
+    // どのスレッドからでも呼べる。書き込みと重なり続けたら false を返す (out の中身は使えない)
+    bool snapshot(Snapshot &out) const {
+        for (int retry = 0; retry < 4; ++retry) {
+            auto before = sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue;
+            }
+            memcpy(&out, &data, sizeof(Snapshot));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == before) {
+                return true;
+            }
+        }
+        return false;
+    }
+    // 次の push() で全て消す
+    void reset() { resetRequested.store(true, std::memory_order_release); }
+
+private:
+    std::atomic<uint64_t> sequence{0};  // 書き込み中は奇数
+    std::atomic<bool> resetRequested{false};
+    Snapshot data;
+    uint64_t startTicks = 0;  // 最初のブロックを push() した時刻 (単位の換算用)
+    std::chrono::steady_clock::time_point startTime;
+};
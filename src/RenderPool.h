@@ -0,0 +1,244 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Constants.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+#if JUCE_MAC || JUCE_IOS
+#include <dispatch/dispatch.h>
+#elif JUCE_WINDOWS
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <semaphore.h>
+#endif
+
+//==============================================================================
+// 眠っているワーカーを起こすためのセマフォ。
+// std::condition_variable と違って起こす側 (オーディオスレッド) がロックを取らないので、優先度の逆転が起きない
+class WakeSemaphore {
+public:
+    WakeSemaphore() {
+#if JUCE_MAC || JUCE_IOS
+        semaphore = dispatch_semaphore_create(0);
+#elif JUCE_WINDOWS
+        semaphore = CreateSemaphoreW(nullptr, 0, 0x7fffffff, nullptr);
+#else
+        sem_init(&semaphore, 0, 0);
+#endif
+    }
+    ~WakeSemaphore() {
+#if JUCE_MAC || JUCE_IOS
+        dispatch_release(semaphore);
+#elif JUCE_WINDOWS
+        CloseHandle(semaphore);
+#else
+        sem_destroy(&semaphore);
+#endif
+    }
+    WakeSemaphore(const WakeSemaphore &) = delete;
+    void signal(int count) {
+        for (int i = 0; i < count; ++i) {
+#if JUCE_MAC || JUCE_IOS
+            dispatch_semaphore_signal(semaphore);
+#elif JUCE_WINDOWS
+            ReleaseSemaphore(semaphore, 1, nullptr);
+#else
+            sem_post(&semaphore);
+#endif
+        }
+    }
+    void wait() {
+#if JUCE_MAC || JUCE_IOS
+        dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER);
+#elif JUCE_WINDOWS
+        WaitForSingleObject(semaphore, INFINITE);
+#else
+        while (sem_wait(&semaphore) != 0 && errno == EINTR) {
+        }
+#endif
+    }
+
+private:
+#if JUCE_MAC || JUCE_IOS
+    dispatch_semaphore_t semaphore;
+#elif JUCE_WINDOWS
+    HANDLE semaphore;
+#else
+    sem_t semaphore;
+#endif
+};
+
+//==============================================================================
+/*
+  オーディオスレッドから呼ばれる並列実行用のスレッドプール。
+  run() に渡したタスクを呼び出し元のスレッドとワーカーで分け合い、全部終わるまで戻らない。
+  ワーカーはオーディオスレッドと同じく実時間の優先度で動かす
+  (優先度が低いと、オーディオスレッドがワーカーの担当分を待つ間に締め切りを過ぎる)。
+
+  タスクの番号は参加するスレッドごとの区間に最初に振り分けておき、自分の区間が空になったら
+  他のスレッドの区間から 1 つずつ盗む (区間の先頭を atomic に進めるだけなのでロックは無い)。
+  待っている間のワーカーは SPIN_COUNT 回 (数十 µs) だけ CPU の pause 命令でスピンしてから眠る
+  (実時間の優先度のまま長く回ると、ホストのオーディオスレッドからコアを奪う)。
+  眠る前に sleepers を増やしてからもう一度仕事を確かめ、
+  run() は受付を始めてから sleepers を読むので、どちらかが必ず相手に気付く (起こし損ねても、余分に起こすだけ)。
+
+  state は (世代 * 2 + 受付中なら 1)。ワーカーは busy を増やしてから受付中であることを確かめて区間に触り、
+  run() は受付を閉じた後 busy が 0 になるのを待ってから戻るので、遅れて来たワーカーが次の準備中の区間を触ることは無い。
+*/
+class RenderPool {
+public:
+    RenderPool() {}
+    ~RenderPool() { setNumThreads(0); }
+    RenderPool(const RenderPool &) = delete;
+
+    // オーディオスレッドが run() していない時に呼ぶこと
+    void setNumThreads(int numThreads) {
+        numThreads = juce::jlimit(0, MAX_RENDER_THREADS, numThreads);
+        if (numThreads == (int)workers.size()) {
+            return;
+        }
+        quit.store(true, std::memory_order_seq_cst);
+        wakeUp.signal((int)workers.size());
+        for (auto &worker : workers) {
+            worker->stopThread(-1);
+        }
+        workers.clear();
+        quit.store(false, std::memory_order_seq_cst);
+        for (int i = 0; i < numThreads; ++i) {
+            workers.push_back(std::make_unique<Worker>(*this, i + 1));
+            workers.back()->startThread(juce::Thread::realtimeAudioPriority);
+        }
+    }
+    int getNumThreads() { return (int)workers.size(); }
+
+    // task(i) を i = 0 ~ numTasks - 1 について実行する
+    template <typename Task>
+    void run(int numTasks, Task &task) {
+        if (numTasks <= 0) {
+            return;
+        }
+        if (workers.empty()) {
+            for (int i = 0; i < numTasks; ++i) {
+                task(i);
+            }
+            return;
+        }
+        currentTask = [](void *context, int index) { (*static_cast<Task *>(context))(index); };
+        currentContext = &task;
+        auto numQueues = (int)workers.size() + 1;
+        for (int q = 0; q < numQueues; ++q) {
+            queues[q].next.store(numTasks * q / numQueues, std::memory_order_relaxed);
+            queues[q].end = numTasks * (q + 1) / numQueues;
+        }
+        remaining.store(numTasks, std::memory_order_relaxed);
+        this->numQueues = numQueues;
+        auto closed = state.load(std::memory_order_relaxed);
+        state.store(closed + 1, std::memory_order_seq_cst);
+        auto numSleepers = sleepers.load(std::memory_order_seq_cst);
+        if (numSleepers > 0) {
+            wakeUp.signal(numSleepers);
+        }
+        work(0);
+        while (remaining.load(std::memory_order_acquire) > 0) {
+            pause();
+        }
+        state.store(closed + 2, std::memory_order_seq_cst);
+        while (busy.load(std::memory_order_seq_cst) > 0) {
+            pause();
+        }
+    }
+
+private:
+    enum { SPIN_COUNT = 1000 };
+    class Worker : public juce::Thread {
+    public:
+        Worker(RenderPool &pool, int self) : juce::Thread("Berry Render Worker"), pool(pool), self(self) {}
+        ~Worker() {}
+        Worker(const Worker &) = delete;
+        void run() override { pool.workerLoop(self); }
+
+    private:
+        RenderPool &pool;
+        int self;
+    };
+    struct alignas(64) Queue {
+        std::atomic<int> next{0};
+        int end = 0;
+    };
+    Queue queues[MAX_RENDER_THREADS + 1];
+    int numQueues = 1;
+    void (*currentTask)(void *, int) = nullptr;
+    void *currentContext = nullptr;
+    alignas(64) std::atomic<int> remaining{0};
+    alignas(64) std::atomic<uint64_t> state{0};
+    std::atomic<int> busy{0};
+    std::atomic<int> sleepers{0};
+    std::atomic<bool> quit{false};
+    std::vector<std::unique_ptr<Worker>> workers;
+    WakeSemaphore wakeUp;
+
+    static void pause() { std::this_thread::yield(); }
+    // ワーカーが仕事を待つ間のスピン 1 回分。OS に返さずにコアの上で少しだけ待つ
+    static void spinPause() {
+#if defined(__x86_64__) || defined(_M_X64)
+        _mm_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#else
+        std::this_thread::yield();
+#endif
+    }
+    // 自分の区間から取り、無くなったら他の区間から盗む
+    void work(int self) {
+        for (int offset = 0; offset < numQueues; ++offset) {
+            auto &queue = queues[(self + offset) % numQueues];
+            while (true) {
+                auto index = queue.next.fetch_add(1, std::memory_order_relaxed);
+                if (index >= queue.end) {
+                    break;
+                }
+                currentTask(currentContext, index);
+                remaining.fetch_sub(1, std::memory_order_release);
+            }
+        }
+    }
+    void workerLoop(int self) {
+        uint64_t seen = 0;
+        auto hasWork = [&] {
+            auto current = state.load(std::memory_order_seq_cst);
+            return (current & 1) != 0 && current != seen;
+        };
+        while (!quit.load(std::memory_order_seq_cst)) {
+            for (int spins = 0; !hasWork() && !quit.load(std::memory_order_relaxed) && spins < SPIN_COUNT; ++spins) {
+                spinPause();
+            }
+            if (!hasWork()) {
+                sleepers.fetch_add(1, std::memory_order_seq_cst);
+                if (!hasWork() && !quit.load(std::memory_order_seq_cst)) {
+                    wakeUp.wait();
+                }
+                sleepers.fetch_sub(1, std::memory_order_seq_cst);
+                continue;
+            }
+            busy.fetch_add(1, std::memory_order_seq_cst);
+            auto current = state.load(std::memory_order_seq_cst);
+            if ((current & 1) != 0 && current != seen) {
+                work(self);
+                seen = current;
+            }
+            busy.fetch_sub(1, std::memory_order_seq_cst);
+        }
+    }
+};
@@ -4,44 +4,9 @@
 
 //==============================================================================
 BerryVoice::BerryVoice(juce::AudioBuffer<float> &buffer, AllParams &allParams)
-    : perf(juce::PerformanceCounter("voice cycle", 100000)),
-      buffer(buffer),
+    : buffer(buffer),
       allParams(allParams),
-      oscs{MultiOsc(false),
-           MultiOsc(false),
-           MultiOsc(false),
-           MultiOsc(false),
-           MultiOsc(false),
-           MultiOsc(false),
-           MultiOsc(false),
-           MultiOsc(false),
-           MultiOsc(false),
-           MultiOsc(false),
-           MultiOsc(false),
-           MultiOsc(false),
-           MultiOsc(false),
-           MultiOsc(false),
-           MultiOsc(false),
-           MultiOsc(true)},
-      adsr{Adsr(),
-           Adsr(),
-           Adsr(),
-           Adsr(),
-           Adsr(),
-           Adsr(),
-           Adsr(),
-           Adsr(),
-           Adsr(),
-           Adsr(),
-           Adsr(),
-           Adsr(),
-           Adsr(),
-           Adsr(),
-           Adsr(),
-           Adsr()},
-      noises{Osc{}, Osc{}},
-      noiseAdsr{Adsr(), Adsr()},
-      noiseFilters{Filter{}, Filter{}, Filter{}, Filter{}} {}
+      noiseFilters{Filter<VoiceSample>{}, Filter<VoiceSample>{}, Filter<VoiceSample>{}, Filter<VoiceSample>{}} {}
 BerryVoice::~BerryVoice() { DBG("BerryVoice's destructor called."); }
 bool BerryVoice::canPlaySound(juce::SynthesiserSound *sound) {
     if (dynamic_cast<BerrySound *>(sound) != nullptr) {
@@ -58,6 +23,13 @@ void BerryVoice::startNote(int midiNoteNumber,
     if (BerrySound *playingSound = dynamic_cast<BerrySound *>(sound)) {
         auto sampleRate = getSampleRate();
         smoothNote.init(midiNoteNumber);
+        controlNote = midiNoteNumber + allParams.globalParams.pitch * allParams.voiceParams.pitchBendRange;
+        controlFreq = getMidiNoteInHertzDouble(controlNote);
+        // 奪われたボイスは鳴っている途中なので位相を揃え直すとクリックになる
+        if (harmonics.isCoherent() && !stolen) {
+            harmonics.resetPhases();
+            sawOsc.setNormalizedAngle(0.0);
+        }
         if (stolen) {
             smoothVelocity.exponentialInfinite(0.01, velocity, sampleRate);
         } else {
@@ -66,38 +38,39 @@ void BerryVoice::startNote(int midiNoteNumber,
         stolen = false;
 
         auto fixedSampleRate = sampleRate * CONTROL_RATE;  // for control
-        auto calculatedParams = CalculatedParams{};
-        auto calculatedNoiseParams = CalculatedParams{};
-        allParams.calculateIntermediateParams(calculatedParams, calculatedNoiseParams, noteNumberAtStart);
+        auto &noteParams = allParams.getNoteParams(noteNumberAtStart);
+        auto &calculatedParams = noteParams.params;
+        auto &calculatedNoiseParams = noteParams.noiseParams;
 
+        harmonics.setSampleRate(sampleRate);
+        sawOsc.setSampleRate(sampleRate);
         for (int i = 0; i < NUM_OSC; ++i) {
-            if (!stolen) {
-                //                oscs[i].setAngle(0.0);
-            }
-            oscs[i].setSampleRate(sampleRate);
-            adsr[i].setParams(calculatedParams.attackCurve[i],
-                              calculatedParams.attack[i],
-                              0.0,
-                              calculatedParams.decay[i],
-                              0.0,
-                              calculatedParams.release[i]);
-            adsr[i].doAttack(fixedSampleRate);
+            envelopes.setParams(i,
+                                calculatedParams.attackCurve[i],
+                                calculatedParams.attack[i],
+                                0.0,
+                                calculatedParams.decay[i],
+                                0.0,
+                                calculatedParams.release[i]);
+            envelopes.doAttack(i, fixedSampleRate);
         }
         for (int i = 0; i < NUM_NOISE; ++i) {
-            noises[i].setSampleRate(sampleRate);
-            noises[i].setWaveform(allParams.noiseUnitParams[i].waveform, true);
-            noiseAdsr[i].setParams(calculatedNoiseParams.attackCurve[i],
-                                   calculatedNoiseParams.attack[i],
-                                   0.0,
-                                   calculatedNoiseParams.decay[i],
-                                   0.0,
-                                   calculatedNoiseParams.release[i]);
-            noiseAdsr[i].doAttack(fixedSampleRate);
+            noises[i].setWaveform(allParams.noiseUnitParams[i].waveform);
+            envelopes.setParams(NUM_OSC + i,
+                                calculatedNoiseParams.attackCurve[i],
+                                calculatedNoiseParams.attack[i],
+                                0.0,
+                                calculatedNoiseParams.decay[i],
+                                0.0,
+                                calculatedNoiseParams.release[i]);
+            envelopes.doAttack(NUM_OSC + i, fixedSampleRate);
             for (int j = 0; j < NUM_NOISE_FILTER; ++j) {
                 noiseFilters[i][j].initializePastData();
                 noiseFilters[i][j].setSampleRate(sampleRate);
             }
         }
+        appliedGeneration = noteParams.generation;
+        appliedSampleRate = sampleRate;
         stepCounter = 0;
     }
 }
@@ -107,35 +80,29 @@ void BerryVoice::stopNote(float velocity, bool allowTailOff) {
         if (allowTailOff) {
             auto sampleRate = getSampleRate();
             auto fixedSampleRate = sampleRate * CONTROL_RATE;  // for control
-            for (int i = 0; i < NUM_OSC; ++i) {
-                if (adsr[i].isReleasing()) {
-                    continue;
-                }
-                adsr[i].doRelease(fixedSampleRate);
-            }
-            for (int i = 0; i < NUM_NOISE; ++i) {
-                if (noiseAdsr[i].isReleasing()) {
+            for (int i = 0; i < NUM_OSC + NUM_NOISE; ++i) {
+                if (envelopes.isReleasing(i)) {
                     continue;
                 }
-                noiseAdsr[i].doRelease(fixedSampleRate);
+                envelopes.doRelease(i, fixedSampleRate);
             }
         } else {
             stolen = true;
-            for (int i = 0; i < NUM_OSC; ++i) {
-                oscs[i].setSampleRate(0.0);  // stop
-            }
-            for (int i = 0; i < NUM_OSC; ++i) {
-                adsr[i].forceStop();
-            }
-            for (int i = 0; i < NUM_NOISE; ++i) {
-                noiseAdsr[i].forceStop();
+            sawOsc.setSampleRate(0.0);  // stop
+            appliedSampleRate = 0.0;
+            for (int i = 0; i < NUM_OSC + NUM_NOISE; ++i) {
+                envelopes.forceStop(i);
             }
             clearCurrentNote();
         }
     }
 }
 void BerryVoice::renderNextBlock(juce::AudioBuffer<float> &outputBuffer, int startSample, int numSamples) {
-    if (BerrySound *playingSound = dynamic_cast<BerrySound *>(getCurrentlyPlayingSound().get())) {
+    renderTo(buffer, startSample, numSamples, outputBuffer.getNumChannels());
+}
+void BerryVoice::renderTo(juce::AudioBuffer<float> &target, int startSample, int numSamples, int numChannels) {
+    // 鳴らせるのは BerrySound だけなので (canPlaySound で確認済み)、ここでは発音中かどうかだけを見る
+    if (isVoiceActive()) {
         // DBG("startSample: " + std::to_string(startSample));
         // DBG("numSamples: " + std::to_string(numSamples));
         if (getCurrentlyPlayingNote() == 0) {
@@ -143,130 +110,265 @@ void BerryVoice::renderNextBlock(juce::AudioBuffer<float> &outputBuffer, int sta
         }
         auto sampleRate = getSampleRate();
 
-        auto calculatedParams = CalculatedParams{};
-        auto calculatedNoiseParams = CalculatedParams{};
-        allParams.calculateIntermediateParams(calculatedParams, calculatedNoiseParams, noteNumberAtStart);
-        applyParamsBeforeLoop(sampleRate, calculatedParams, calculatedNoiseParams);
+        auto &noteParams = allParams.getNoteParams(noteNumberAtStart);
+        // パラメータもサンプルレートも変わっていなければ設定し直す必要は無い
+        if (noteParams.generation != appliedGeneration || sampleRate != appliedSampleRate) {
+            applyParamsBeforeLoop(sampleRate, noteParams.params, noteParams.noiseParams);
+            appliedGeneration = noteParams.generation;
+            appliedSampleRate = sampleRate;
+        }
+        // ノイズの波形はノートごとのパラメータの世代に入らないので、毎ブロック反映する
+        for (int i = 0; i < NUM_NOISE; ++i) {
+            noises[i].setWaveform(allParams.noiseUnitParams[i].waveform);
+        }
 
-        int numChannels = outputBuffer.getNumChannels();
         jassert(numChannels <= 2);
-        while (--numSamples >= 0) {
-            double out[2]{0, 0};
-            auto active = step(out, sampleRate, numChannels, calculatedParams, calculatedNoiseParams);
-            for (auto ch = 0; ch < numChannels; ++ch) {
-                buffer.addSample(ch, startSample, out[ch]);
-            }
-            ++startSample;
-            if (!active) {
-                clearCurrentNote();
-                break;
-            }
+        auto active = renderBlock(
+            target, startSample, numSamples, sampleRate, numChannels, noteParams.params, noteParams.noiseParams);
+        if (!active) {
+            clearCurrentNote();
         }
     }
 }
-void BerryVoice::applyParamsBeforeLoop(double sampleRate, CalculatedParams &params, CalculatedParams &noiseParams) {
+void BerryVoice::applyParamsBeforeLoop(double sampleRate,
+                                       const CalculatedParams &params,
+                                       const CalculatedParams &noiseParams) {
+    harmonics.setSampleRate(sampleRate);
+    sawOsc.setSampleRate(sampleRate);
     for (int i = 0; i < NUM_OSC; ++i) {
-        oscs[i].setSampleRate(sampleRate);
-        adsr[i].setParams(params.attackCurve[i], params.attack[i], 0.0, params.decay[i], 0.0, params.release[i]);
+        envelopes.setParams(
+            i, params.attackCurve[i], params.attack[i], 0.0, params.decay[i], 0.0, params.release[i]);
     }
     for (int i = 0; i < NUM_NOISE; ++i) {
-        noises[i].setSampleRate(sampleRate);
-        noises[i].setWaveform(allParams.noiseUnitParams[i].waveform, true);
-        noiseAdsr[i].setParams(
-            noiseParams.attackCurve[i], noiseParams.attack[i], 0.0, noiseParams.decay[i], 0.0, noiseParams.release[i]);
+        envelopes.setParams(NUM_OSC + i,
+                            noiseParams.attackCurve[i],
+                            noiseParams.attack[i],
+                            0.0,
+                            noiseParams.decay[i],
+                            0.0,
+                            noiseParams.release[i]);
+    }
+}
+bool BerryVoice::renderBlock(juce::AudioBuffer<float> &target,
+                             int startSample,
+                             int numSamples,
+                             double sampleRate,
+                             int numChannels,
+                             const CalculatedParams &params,
+                             const CalculatedParams &noiseParams) {
+    while (numSamples > 0) {
+        auto subBlockSize = std::min(numSamples, MAX_SUB_BLOCK_SIZE);
+        if (!renderSubBlock(target, startSample, subBlockSize, sampleRate, numChannels, params, noiseParams)) {
+            return false;
+        }
+        startSample += subBlockSize;
+        numSamples -= subBlockSize;
     }
+    return true;
 }
-bool BerryVoice::step(
-    double *out, double sampleRate, int numChannels, CalculatedParams &params, CalculatedParams &noiseParams) {
-    smoothNote.step();
-    smoothVelocity.step();
+bool BerryVoice::renderSubBlock(juce::AudioBuffer<float> &target,
+                                int startSample,
+                                int numSamples,
+                                double sampleRate,
+                                int numChannels,
+                                const CalculatedParams &params,
+                                const CalculatedParams &noiseParams) {
+    jassert(numSamples <= MAX_SUB_BLOCK_SIZE);
 
-    double midiNoteNumber = smoothNote.value + allParams.globalParams.pitch * allParams.voiceParams.pitchBendRange;
-    auto baseFreq = getMidiNoteInHertzDouble(midiNoteNumber);
+    // ---------------- Envelope ----------------
+    // エンベロープは CONTROL_INTERVAL ごとにしか変化しないので、値が一定の区間に分割しておく
+    auto fixedSampleRate = sampleRate * CONTROL_RATE;
+    bool active = true;
+    int numSegments = 0;
+    int position = 0;
+    {
+        BERRY_PROFILE_ZONE(Envelope);
+        while (position < numSamples) {
+            if (stepCounter == 0) {
+                envelopes.step(fixedSampleRate);
+            }
+            auto &segment = segments[numSegments];
+            segment.start = position;
+            segment.length = std::min(CONTROL_INTERVAL - stepCounter, numSamples - position);
+            // 前のティックの値から今のティックの値までを CONTROL_INTERVAL サンプルかけて補間する。
+            // 止まったばかりのエンベロープも 0 まで下げきるまでは鳴らす
+            auto rampPosition = (VoiceSample)stepCounter / CONTROL_INTERVAL;
+            auto rampLength = (VoiceSample)segment.length / CONTROL_INTERVAL;
+            bool anyActive = false;
+            segment.oscMask = 0;
+            for (int i = 0; i < NUM_OSC; ++i) {
+                if (allParams.soloMuteParams.harmonicMute[i] ||
+                    (!envelopes.isActive(i) && envelopes.getPreviousValue(i) == 0)) {
+                    continue;
+                }
+                anyActive = true;
+                VoiceSample start, end;
+                envelopes.getRamp(i, rampPosition, rampLength, start, end);
+                segment.oscGain[i] = start * params.gain[i];
+                segment.oscTargetGain[i] = end * params.gain[i];
+                if (segment.oscGain[i] != 0.0 || segment.oscTargetGain[i] != 0.0) {
+                    segment.oscMask |= 1u << i;
+                }
+            }
+            segment.noiseMask = 0;
+            for (int i = 0; i < NUM_NOISE; ++i) {
+                auto lane = NUM_OSC + i;
+                if (allParams.soloMuteParams.noiseMute[i] ||
+                    (!envelopes.isActive(lane) && envelopes.getPreviousValue(lane) == 0)) {
+                    continue;
+                }
+                // ゲインが 0 になってもフィルターの残響は続くので、エンベロープが止まるまでは計算する
+                anyActive = true;
+                VoiceSample start, end;
+                envelopes.getRamp(lane, rampPosition, rampLength, start, end);
+                segment.noiseGain[i] = start * noiseParams.gain[i];
+                segment.noiseTargetGain[i] = end * noiseParams.gain[i];
+                segment.noiseMask |= 1u << i;
+            }
+            if (!anyActive) {
+                active = false;
+                break;
+            }
+            stepCounter = (stepCounter + segment.length) % CONTROL_INTERVAL;
+            position += segment.length;
+            numSegments++;
+        }
+    }
+    numSamples = position;
 
-    if (stepCounter == 0) {
-        auto fixedSampleRate = sampleRate * CONTROL_RATE;
-        for (int i = 0; i < NUM_OSC; ++i) {
-            adsr[i].step(fixedSampleRate);
+    // ---------------- Pitch and Velocity ----------------
+    // 周波数 (std::pow) は区間の終わりでだけ計算し、区間内は直前の値から線形補間する
+    auto pitchBend = allParams.globalParams.pitch * allParams.voiceParams.pitchBendRange;
+    for (int s = 0; s < numSegments; ++s) {
+        auto &segment = segments[s];
+        auto *freqs = blockFreqs + segment.start;
+        auto *gains = blockGains + segment.start;
+        for (int i = 0; i < segment.length; ++i) {
+            smoothNote.step();
+            smoothVelocity.step();
+            gains[i] = 0.3 * smoothVelocity.value;
         }
-        for (int i = 0; i < NUM_NOISE; ++i) {
-            noiseAdsr[i].step(fixedSampleRate);
+        auto note = smoothNote.value + pitchBend;
+        if (note == controlNote) {
+            std::fill_n(freqs, segment.length, controlFreq);
+            continue;
         }
-    }
-    stepCounter++;
-    if (stepCounter >= CONTROL_INTERVAL) {
-        stepCounter = 0;
+        auto freq = getMidiNoteInHertzDouble(note);
+        auto delta = (freq - controlFreq) / segment.length;
+        for (int i = 0; i < segment.length; ++i) {
+            freqs[i] = controlFreq + delta * (i + 1);
+        }
+        controlNote = note;
+        controlFreq = freq;
     }
 
-    bool active = false;
-    auto panBase = allParams.masterParams.pan;
+    auto pan = allParams.masterParams.pan;
     if (allParams.globalParams.pan >= 0) {
-        panBase = (1 - panBase) * allParams.globalParams.pan + panBase;
+        pan = (1 - pan) * allParams.globalParams.pan + pan;
     } else {
-        panBase = (1 + panBase) * allParams.globalParams.pan + panBase;
+        pan = (1 + pan) * allParams.globalParams.pan + pan;
     }
+    jassert(pan >= -1);
+    jassert(pan <= 1);
 
-    // ---------------- OSC with Envelope and Filter ----------------
-    for (int oscIndex = 0; oscIndex < NUM_OSC; ++oscIndex) {
-        if (allParams.soloMuteParams.harmonicMute[oscIndex]) {
-            continue;
-        }
-        if (!adsr[oscIndex].isActive()) {
-            continue;
+    // ---------------- OSC with Envelope ----------------
+    std::fill_n(blockMix[0], numSamples, 0.0);
+    std::fill_n(blockMix[1], numSamples, 0.0);
+    {
+        BERRY_PROFILE_ZONE(Osc);
+        auto sawIndex = NUM_OSC - 1;
+        auto sineMask = (1u << sawIndex) - 1;
+        for (int s = 0; s < numSegments; ++s) {
+            auto &segment = segments[s];
+            auto mask = segment.oscMask & sineMask;
+            harmonics.setActiveLanes(mask);
+            for (int oscIndex = 0; oscIndex < sawIndex; ++oscIndex) {
+                if (mask & (1u << oscIndex)) {
+                    harmonics.setGainRamp(oscIndex, segment.oscGain[oscIndex], segment.oscTargetGain[oscIndex]);
+                }
+            }
+            harmonics.addBlock(pan,
+                               blockFreqs + segment.start,
+                               blockMix[0] + segment.start,
+                               blockMix[1] + segment.start,
+                               segment.length);
+            // 最後のオシレーターは基音の周波数で高次倍音 (ノコギリ波のテーブル) を鳴らす
+            if (segment.oscMask & (1u << sawIndex)) {
+                sawOsc.addBlock(pan,
+                                blockFreqs + segment.start,
+                                1.0,
+                                segment.oscGain[sawIndex],
+                                segment.oscTargetGain[sawIndex],
+                                blockMix[0] + segment.start,
+                                blockMix[1] + segment.start,
+                                segment.length);
+            }
         }
-        active = true;
-        auto freq = oscIndex == NUM_OSC - 1 ? baseFreq : baseFreq * (oscIndex + 1);
-        auto pan = panBase;
-        jassert(pan >= -1);
-        jassert(pan <= 1);
-
-        double o[2]{0, 0};
-        auto sineGain = adsr[oscIndex].getValue() * params.gain[oscIndex];
-
-        oscs[oscIndex].step(pan, freq, 0.0, sineGain, o);
+    }
 
-        out[0] += o[0];
-        out[1] += o[1];
+    // ---------------- Noise with Envelope and Filter ----------------
+    uint32_t noiseMask = 0;
+    for (int s = 0; s < numSegments; ++s) {
+        noiseMask |= segments[s].noiseMask;
     }
     for (int noiseIndex = 0; noiseIndex < NUM_NOISE; ++noiseIndex) {
-        if (allParams.soloMuteParams.noiseMute[noiseIndex]) {
-            continue;
-        }
-        if (!noiseAdsr[noiseIndex].isActive()) {
+        if (!(noiseMask & (1u << noiseIndex))) {
             continue;
         }
-        active = true;
         auto &noiseUnitParams = allParams.noiseUnitParams[noiseIndex];
-
-        auto gain = noiseAdsr[noiseIndex].getValue() * noiseParams.gain[noiseIndex];
-        auto value = noises[noiseIndex].step(440, 0.0) * gain;
-        double o[2]{value, value};
-
+        double filterFreqs[NUM_NOISE_FILTER];
         for (int filterIndex = 0; filterIndex < NUM_NOISE_FILTER; ++filterIndex) {
             auto &fp = noiseUnitParams.filterParams[filterIndex];
-            if (!fp.enabled) {
+            filterFreqs[filterIndex] =
+                fp.isFreqAbsoluteFreezed ? fp.hz : getMidiNoteInHertzDouble(noteNumberAtStart + fp.semitone);
+        }
+        for (int s = 0; s < numSegments; ++s) {
+            auto &segment = segments[s];
+            if (!(segment.noiseMask & (1u << noiseIndex))) {
                 continue;
             }
-            auto freq = fp.isFreqAbsoluteFreezed ? fp.hz : getMidiNoteInHertzDouble(noteNumberAtStart + fp.semitone);
-            for (auto ch = 0; ch < numChannels; ++ch) {
-                o[ch] = noiseFilters[noiseIndex][filterIndex].step(fp.type, freq, fp.q, fp.gain, ch, o[ch]);
+            BERRY_PROFILE_ZONE(Noise);
+            auto gain = segment.noiseGain[noiseIndex];
+            auto gainDelta = (segment.noiseTargetGain[noiseIndex] - gain) / segment.length;
+            auto *noiseL = blockNoise[0] + segment.start;
+            auto *noiseR = blockNoise[1] + segment.start;
+            noises[noiseIndex].fill(noiseL, segment.length);
+            for (int i = 0; i < segment.length; ++i) {
+                noiseL[i] = noiseR[i] = noiseL[i] * (gain + gainDelta * (i + 1));
+            }
+            {
+                BERRY_PROFILE_ZONE(NoiseFilter);
+                Filter<VoiceSample> *enabledFilters[NUM_NOISE_FILTER];
+                int numEnabledFilters = 0;
+                for (int filterIndex = 0; filterIndex < NUM_NOISE_FILTER; ++filterIndex) {
+                    auto &fp = noiseUnitParams.filterParams[filterIndex];
+                    if (!fp.enabled) {
+                        continue;
+                    }
+                    auto &filter = noiseFilters[noiseIndex][filterIndex];
+                    filter.setParams(fp.type, filterFreqs[filterIndex], fp.q, fp.gain, segment.length);
+                    enabledFilters[numEnabledFilters++] = &filter;
+                }
+                Filter<VoiceSample>::processCascade(enabledFilters, numEnabledFilters, noiseL, noiseR, segment.length);
+            }
+            BERRY_PROFILE_ZONE(Mix);
+            auto *mixL = blockMix[0] + segment.start;
+            auto *mixR = blockMix[1] + segment.start;
+            for (int i = 0; i < segment.length; ++i) {
+                mixL[i] += noiseL[i];
+                mixR[i] += noiseR[i];
             }
         }
-        out[0] += o[0];
-        out[1] += o[1];
     }
 
-    auto finalGain = 0.3 * smoothVelocity.value;
+    // ---------------- Mix ----------------
+    BERRY_PROFILE_ZONE(Mix);
     for (auto ch = 0; ch < numChannels; ++ch) {
-        out[ch] *= finalGain;
+        auto *mix = blockMix[ch];
+        auto *dest = target.getWritePointer(ch, startSample);
+        for (int i = 0; i < numSamples; ++i) {
+            dest[i] += (float)(mix[i] * blockGains[i]);
+        }
     }
     return active;
-    // for (auto ch = 0; ch < numChannels; ++ch) {
-    //     outputBuffer.addSample (ch, startSample, out[ch]);
-    // }
-    // ++startSample;
-    // if(!active) {
-    //     clearCurrentNote();
-    //     break;
-    // }
 }
@@ -5,6 +5,8 @@
 #include "Constants.h"
 #include "DSP.h"
 #include "Params.h"
+#include "Profiler.h"
+#include "RenderPool.h"
 
 namespace {
 const double A = 1.0 / 12.0;
@@ -12,6 +14,9 @@ const double X = std::pow(2.0, 1.0 / 12.0);
 const double Y = 440.0 / std::pow(X, 69);
 const int CONTROL_INTERVAL = 16;
 const double CONTROL_RATE = 1.0 / CONTROL_INTERVAL;
+const int MAX_SUB_BLOCK_SIZE = 128;
+const int MAX_CONTROL_SEGMENTS = MAX_SUB_BLOCK_SIZE / CONTROL_INTERVAL + 1;
+static_assert(NUM_OSC - 1 <= NUM_HARMONIC_LANES);
 }  // namespace
 
 //==============================================================================
@@ -105,7 +110,8 @@ private:
 };
 
 //==============================================================================
-class BerryVoice : public juce::SynthesiserVoice {
+// ボイスはオーディオスレッドから毎ブロック触るので、隣のボイスとキャッシュラインを共有しないようにする
+class alignas(64) BerryVoice : public juce::SynthesiserVoice {
 public:
     BerryVoice(juce::AudioBuffer<float> &buffer, AllParams &allParams);
     ~BerryVoice();
@@ -118,26 +124,73 @@ public:
     virtual void pitchWheelMoved(int) override{};
     virtual void controllerMoved(int, int) override{};
     void renderNextBlock(juce::AudioSampleBuffer &outputBuffer, int startSample, int numSamples) override;
-    void applyParamsBeforeLoop(double sampleRate, CalculatedParams &params, CalculatedParams &noiseParams);
-    bool step(double *out, double sampleRate, int numChannels, CalculatedParams &params, CalculatedParams &noiseParams);
+    // renderNextBlock と同じだが、共有のバッファではなく target に足し込む (並列に描画するとき用)
+    void renderTo(juce::AudioBuffer<float> &target, int startSample, int numSamples, int numChannels);
+    // 描画中に AllParams のキャッシュを書き換えないよう、並列に描画する前に呼んでおく
+    void prefetchParams() { allParams.getNoteParams(noteNumberAtStart); }
+    void applyParamsBeforeLoop(double sampleRate, const CalculatedParams &params, const CalculatedParams &noiseParams);
+    bool renderBlock(juce::AudioBuffer<float> &target,
+                     int startSample,
+                     int numSamples,
+                     double sampleRate,
+                     int numChannels,
+                     const CalculatedParams &params,
+                     const CalculatedParams &noiseParams);
+    void setHarmonicEngine(HARMONIC_ENGINE engine) { harmonics.setEngine(engine); }
+    void setCoherentHarmonics(bool coherent) { harmonics.setCoherent(coherent); }
+    // ノイズの乱数の種。ボイスごとに違う値を渡すと、同じ MIDI からは毎回同じ音が書き出される
+    void setNoiseSeed(uint64_t seed) {
+        for (int i = 0; i < NUM_NOISE; ++i) {
+            noises[i].setSeed(seed * NUM_NOISE + i);
+        }
+    }
     int noteNumberAtStart = -1;
 
 private:
-    juce::PerformanceCounter perf;
-
     AllParams &allParams;
     juce::AudioBuffer<float> &buffer;
 
-    MultiOsc oscs[NUM_OSC];
-    Adsr adsr[NUM_OSC];
-    Osc noises[NUM_NOISE];
-    Adsr noiseAdsr[NUM_NOISE];
-    Filter noiseFilters[NUM_NOISE][NUM_NOISE_FILTER];
+    HarmonicBank harmonics;  // 0 ~ NUM_OSC - 2 番目の倍音のサイン波をまとめて計算する
+    // NUM_OSC - 1 番目は基音の周波数で高次倍音 (ノコギリ波のテーブル) を鳴らす
+    MultiOsc<VoiceSample> sawOsc{true};
+    NoiseGenerator noises[NUM_NOISE];
+    // 0 ~ NUM_OSC - 1 が倍音、NUM_OSC ~ NUM_OSC + NUM_NOISE - 1 がノイズのエンベロープ
+    EnvelopeBank<VoiceSample, NUM_OSC + NUM_NOISE> envelopes;
+    Filter<VoiceSample> noiseFilters[NUM_NOISE][NUM_NOISE_FILTER];
 
-    TransitiveValue smoothNote;
-    TransitiveValue smoothVelocity;
+    TransitiveValue<double> smoothNote;  // 周波数になるので double のまま
+    TransitiveValue<VoiceSample> smoothVelocity;
+    double controlNote = 0.0;  // 最後に周波数を計算したときのノート (ピッチベンド込み)
+    double controlFreq = 0.0;
     bool stolen = false;
     int stepCounter = 0;
+    uint64_t appliedGeneration = 0;  // applyParamsBeforeLoop で設定済みのパラメータの世代
+    double appliedSampleRate = 0.0;
+
+    // renderBlock 用の作業領域
+    struct ControlSegment {
+        int start;
+        int length;
+        uint32_t oscMask;    // 音を出す倍音のビット (ミュートされておらず、エンベロープが動いていて、ゲインが 0 でない)
+        uint32_t noiseMask;  // 音を出すノイズのビット (ミュートされておらず、エンベロープが動いている)
+        // 区間の最初と最後のゲイン (区間の中は線形に補間する)
+        VoiceSample oscGain[NUM_OSC];
+        VoiceSample oscTargetGain[NUM_OSC];
+        VoiceSample noiseGain[NUM_NOISE];
+        VoiceSample noiseTargetGain[NUM_NOISE];
+    };
+    ControlSegment segments[MAX_CONTROL_SEGMENTS];
+    double blockFreqs[MAX_SUB_BLOCK_SIZE];
+    VoiceSample blockGains[MAX_SUB_BLOCK_SIZE];
+    VoiceSample blockMix[2][MAX_SUB_BLOCK_SIZE];
+    VoiceSample blockNoise[2][MAX_SUB_BLOCK_SIZE];
+    bool renderSubBlock(juce::AudioBuffer<float> &target,
+                        int startSample,
+                        int numSamples,
+                        double sampleRate,
+                        int numChannels,
+                        const CalculatedParams &params,
+                        const CalculatedParams &noiseParams);
 
     SparseLog sparseLog = SparseLog(10000);
     double getMidiNoteInHertzDouble(double noteNumber) {
@@ -155,6 +208,23 @@ public:
         addSound(new BerrySound());
     }
     ~BerrySynthesiser() {}
+    // numThreads 個のワーカーとオーディオスレッドでボイスを分けて描画する (0 ならオーディオスレッドだけで描画する)
+    // オーディオスレッドが止まっている時 (prepareToPlay など) に呼ぶこと
+    void prepareParallelRendering(int numThreads, int maximumBlockSize) {
+        renderPool.setNumThreads(numThreads);
+        voiceBuffers.resize(voices.size());
+        for (auto &voiceBuffer : voiceBuffers) {
+            voiceBuffer.setSize(2, maximumBlockSize);
+        }
+        activeVoices.resize(voices.size());
+#if BERRY_PROFILE
+        voiceProfileTicks.resize(voices.size());
+#endif
+    }
+    void setCurrentPlaybackSampleRate(double sampleRate) override {
+        juce::Synthesiser::setCurrentPlaybackSampleRate(sampleRate);
+        stereoDelay.prepare(sampleRate, MAX_DELAY_TIME);
+    }
     virtual void renderNextBlock(AudioBuffer<float> &outputAudio,
                                  const MidiBuffer &inputMidi,
                                  int startSample,
@@ -162,6 +232,7 @@ public:
         allParams.freeze();
         buffer.setSize(2, startSample + numSamples, false, false, true);
         buffer.clear();
+        applyPolyphony();
 
         juce::Synthesiser::renderNextBlock(outputAudio, inputMidi, startSample, numSamples);
     }
@@ -208,7 +279,12 @@ public:
         }
     }
     void renderVoices(juce::AudioBuffer<float> &outBuffer, int startSample, int numSamples) override {
-        juce::Synthesiser::renderVoices(outBuffer, startSample, numSamples);
+        if (renderPool.getNumThreads() > 0 && (int)voices.size() <= (int)voiceBuffers.size() &&
+            numSamples <= voiceBuffers[0].getNumSamples()) {
+            renderVoicesInParallel(outBuffer.getNumChannels(), startSample, numSamples);
+        } else {
+            juce::Synthesiser::renderVoices(outBuffer, startSample, numSamples);
+        }
 
         auto &mainParams = allParams.mainParams;
         auto &delayParams = allParams.delayParams;
@@ -227,22 +303,33 @@ public:
         auto *leftIn = buffer.getReadPointer(0, startSample);
         auto *rightIn = buffer.getReadPointer(1, startSample);
 
+        auto *leftOut = outBuffer.getWritePointer(0, startSample);
+        auto *rightOut = outBuffer.getWritePointer(1, startSample);
+
         auto delayEnabled = delayParams.enabled;
         auto expression = allParams.globalParams.expression;
         auto masterVolume = allParams.masterParams.masterVolume * allParams.globalParams.midiVolume;
-        for (int i = 0; i < numSamples; ++i) {
-            double sample[2]{leftIn[i] * expression, rightIn[i] * expression};
+        BERRY_PROFILE_ZONE(Mix);
+        for (int offset = 0; offset < numSamples; offset += EFFECT_BLOCK_SIZE) {
+            auto length = std::min((int)EFFECT_BLOCK_SIZE, numSamples - offset);
+            VoiceSample left[EFFECT_BLOCK_SIZE];
+            VoiceSample right[EFFECT_BLOCK_SIZE];
+            for (int i = 0; i < length; ++i) {
+                left[i] = leftIn[offset + i] * expression;
+                right[i] = rightIn[offset + i] * expression;
+            }
 
             // Delay
             if (delayEnabled) {
-                stereoDelay.step(sample);
+                BERRY_PROFILE_ZONE(Delay);
+                stereoDelay.process(left, right, length);
             }
 
             // Master Volume
-            sample[0] *= masterVolume;
-            sample[1] *= masterVolume;
-            outBuffer.addSample(0, startSample + i, sample[0]);
-            outBuffer.addSample(1, startSample + i, sample[1]);
+            for (int i = 0; i < length; ++i) {
+                leftOut[offset + i] += (float)(left[i] * masterVolume);
+                rightOut[offset + i] += (float)(right[i] * masterVolume);
+            }
         }
     }
     void controllerMoved(int number, int value) {
@@ -270,10 +357,144 @@ public:
         allParams.globalParams.freeze();
     }
 
+protected:
+    // ボイスは MAX_VOICES 個作ってあるが、発音には先頭の polyphony 個だけを使う
+    juce::SynthesiserVoice *findFreeVoice(juce::SynthesiserSound *soundToPlay,
+                                          int midiChannel,
+                                          int midiNoteNumber,
+                                          bool stealIfNoneAvailable) const override {
+        auto numVoices = getNumUsableVoices();
+        for (int i = 0; i < numVoices; ++i) {
+            auto *voice = voices[i];
+            if (!voice->isVoiceActive() && voice->canPlaySound(soundToPlay)) {
+                return voice;
+            }
+        }
+        if (stealIfNoneAvailable) {
+            return findVoiceToSteal(soundToPlay, midiChannel, midiNoteNumber);
+        }
+        return nullptr;
+    }
+    // juce::Synthesiser::findVoiceToSteal と同じ規則 (古いものから奪い、押さえている最低音と最高音は守る) を
+    // 先頭の polyphony 個だけに当てはめる。JUCE の実装と違ってメモリを確保しない
+    juce::SynthesiserVoice *findVoiceToSteal(juce::SynthesiserSound *soundToPlay,
+                                             int midiChannel,
+                                             int midiNoteNumber) const override {
+        juce::SynthesiserVoice *usableVoices[MAX_VOICES];
+        int numUsableVoices = 0;
+        juce::SynthesiserVoice *low = nullptr;  // 最低音 (サステインされていてもよいが、リリース中は除く)
+        juce::SynthesiserVoice *top = nullptr;  // 最高音 (同上)
+        auto numVoices = std::min(getNumUsableVoices(), (int)MAX_VOICES);
+        for (int i = 0; i < numVoices; ++i) {
+            auto *voice = voices[i];
+            if (!voice->canPlaySound(soundToPlay)) {
+                continue;
+            }
+            usableVoices[numUsableVoices++] = voice;
+            if (!voice->isPlayingButReleased()) {
+                auto note = voice->getCurrentlyPlayingNote();
+                if (low == nullptr || note < low->getCurrentlyPlayingNote()) {
+                    low = voice;
+                }
+                if (top == nullptr || note > top->getCurrentlyPlayingNote()) {
+                    top = voice;
+                }
+            }
+        }
+        std::sort(usableVoices, usableVoices + numUsableVoices, [](auto *a, auto *b) {
+            return a->wasStartedBefore(*b);
+        });
+        // 1 音しか押さえていなければ低い方を優先する
+        if (top == low) {
+            top = nullptr;
+        }
+        // 同じ音を鳴らしているもの、リリース中のもの、鍵盤が離されたもの、守らなくてよいもの、の順に古いものを選ぶ
+        for (int i = 0; i < numUsableVoices; ++i) {
+            if (usableVoices[i]->getCurrentlyPlayingNote() == midiNoteNumber) {
+                return usableVoices[i];
+            }
+        }
+        for (int i = 0; i < numUsableVoices; ++i) {
+            auto *voice = usableVoices[i];
+            if (voice != low && voice != top && voice->isPlayingButReleased()) {
+                return voice;
+            }
+        }
+        for (int i = 0; i < numUsableVoices; ++i) {
+            auto *voice = usableVoices[i];
+            if (voice != low && voice != top && !voice->isKeyDown()) {
+                return voice;
+            }
+        }
+        for (int i = 0; i < numUsableVoices; ++i) {
+            auto *voice = usableVoices[i];
+            if (voice != low && voice != top) {
+                return voice;
+            }
+        }
+        // 守っている音しか無ければ、2 音なら高い方、1 音ならそれを奪う
+        return top != nullptr ? top : low;
+    }
+
 private:
+    enum { EFFECT_BLOCK_SIZE = 64 };  // エフェクトはこの長さずつ一時バッファに取り出して処理する
     MonoStack &monoStack;
     juce::AudioBuffer<float> &buffer;
+    int appliedPolyphony = MAX_VOICES;
+    RenderPool renderPool;
+    std::vector<juce::AudioBuffer<float>> voiceBuffers;  // 並列描画用。ボイスごとの書き込み先
+    std::vector<BerryVoice *> activeVoices;
+#if BERRY_PROFILE
+    std::vector<ProfileTicks> voiceProfileTicks;  // 並列描画用。ボイスごとに測った時間
+#endif
+
+    void renderVoicesInParallel(int numChannels, int startSample, int numSamples) {
+        int numActiveVoices = 0;
+        for (auto *voice : voices) {
+            if (voice->isVoiceActive()) {
+                auto *berryVoice = static_cast<BerryVoice *>(voice);
+                berryVoice->prefetchParams();
+                activeVoices[numActiveVoices++] = berryVoice;
+            }
+        }
+        auto renderVoice = [&](int i) {
+            auto &voiceBuffer = voiceBuffers[i];
+            voiceBuffer.clear(0, numSamples);
+            activeVoices[i]->renderTo(voiceBuffer, 0, numSamples, numChannels);
+#if BERRY_PROFILE
+            // ワーカーで測った分はボイスごとに取り出し、下でオーディオスレッドの積算に移す
+            voiceProfileTicks[i] = takeThreadProfileTicks();
+#endif
+        };
+        renderPool.run(numActiveVoices, renderVoice);
+        // どのスレッドが描画したかに関係なく同じ結果になるよう、ボイスの順番に足す
+        BERRY_PROFILE_ZONE(Mix);
+        for (int i = 0; i < numActiveVoices; ++i) {
+            for (int ch = 0; ch < numChannels; ++ch) {
+                buffer.addFrom(ch, startSample, voiceBuffers[i], ch, 0, numSamples);
+            }
+#if BERRY_PROFILE
+            threadProfileSlot().total.add(voiceProfileTicks[i]);
+#endif
+        }
+    }
+
+    int getNumUsableVoices() const { return std::min((int)voices.size(), allParams.voiceParams.polyphony); }
+    // 発音数を減らしたときは範囲外のボイスをリリースさせる
+    void applyPolyphony() {
+        auto polyphony = allParams.voiceParams.polyphony;
+        if (polyphony == appliedPolyphony) {
+            return;
+        }
+        for (int i = polyphony; i < (int)voices.size(); ++i) {
+            auto *voice = voices[i];
+            if (voice->isVoiceActive()) {
+                stopVoice(voice, 0.0f, true);
+            }
+        }
+        appliedPolyphony = polyphony;
+    }
     AllParams &allParams;
 
-    StereoDelay stereoDelay{};
+    StereoDelay<VoiceSample> stereoDelay{};
 };
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "MathConstants.h"
+
+// ウェーブテーブルの波形の定義と、キャッシュファイルを確かめるためのハッシュ。
+// プラグイン (WavetableStore) と wavetable-gen の両方が使うので JUCE に依存しない。
+// キャッシュはここの定義で作ったものしか読まないので、波形を変える時はここだけを変えればよい
+namespace wavetable {
+
+// キャッシュのヘッダに書く波形の番号
+enum class WAVEFORM_ID { SawHigh = 1, Sine = 2, Saw = 3, Square = 4, Triangle = 5 };
+
+const int DEFAULT_LEVELS_PER_OCTAVE = 2;
+
+// キャッシュの波形ごとのヘッダ (int32 * CACHE_HEADER_SIZE): 形式の版、テーブルのビット数、levelsPerOctave、
+// 段数、波形の番号、hashSpectrum()、hashBody()。
+// 後ろに各段の倍音数 (int32 * 段数) とテーブル (float * (サイズ + 1) * 段数) が続く
+const int CACHE_FORMAT_VERSION = 3;
+const int CACHE_HEADER_SIZE = 7;
+
+// h 倍音の複素振幅 (e^{ihθ} の係数)。maxHarmonic はその段に入る一番上の倍音
+using Spectrum = std::complex<double> (*)(int h, int maxHarmonic);
+
+// ギブス現象を抑える窓
+inline double gibbsFix(int h, int maxHarmonic) {
+    return std::pow(std::cos((h - 1) * math_constants::HALF_PI / maxHarmonic), 2);
+}
+inline std::complex<double> sine(double amplitude) { return std::complex<double>(0.0, -0.5 * amplitude); }
+
+inline std::complex<double> saw(int h, int maxHarmonic) { return sine(gibbsFix(h, maxHarmonic) / h); }
+// 16 倍音から上のノコギリ波 (15 倍音まではプラグインのサイン波のオシレーターが鳴らす)
+inline std::complex<double> sawHigh(int h, int maxHarmonic) { return h < 16 ? 0.0 : saw(h, maxHarmonic); }
+inline std::complex<double> square(int h, int maxHarmonic) { return h % 2 == 0 ? 0.0 : saw(h, maxHarmonic); }
+inline std::complex<double> triangle(int h, int) {
+    return h % 2 == 0 ? 0.0 : sine(((h / 2) % 2 == 0 ? 1.0 : -1.0) / (h * h));
+}
+inline std::complex<double> fundamental(int h, int) { return h == 1 ? sine(1.0) : 0.0; }
+
+struct Waveform {
+    WAVEFORM_ID id;
+    Spectrum spectrum;
+    int lowestHarmonic;   // これより少ない倍音しか入らない段は作らない
+    int highestHarmonic;  // 0 ならテーブルに入るだけ入れる
+    int levelsPerOctave;  // 0 なら使う側が決める (段が 1 つしかない波形は 1 に固定する)
+};
+
+inline Waveform getWaveform(WAVEFORM_ID id) {
+    switch (id) {
+        case WAVEFORM_ID::SawHigh:
+            return {id, sawHigh, 16, 0, 0};
+        case WAVEFORM_ID::Saw:
+            return {id, saw, 1, 0, 0};
+        case WAVEFORM_ID::Square:
+            return {id, square, 1, 0, 0};
+        case WAVEFORM_ID::Triangle:
+            return {id, triangle, 1, 0, 0};
+        case WAVEFORM_ID::Sine:
+        default:
+            return {WAVEFORM_ID::Sine, fundamental, 1, 1, 1};
+    }
+}
+
+// 各段に入れる倍音の数。段 k は highestHarmonic * 2^(-k / levelsPerOctave) 倍音まで
+inline std::vector<int32_t> getMaxHarmonics(int levelsPerOctave, int lowestHarmonic, int highestHarmonic) {
+    std::vector<int32_t> maxHarmonics;
+    for (int k = 0;; ++k) {
+        auto maxHarmonic = (int)(highestHarmonic * std::exp2(-(double)k / levelsPerOctave));
+        if (maxHarmonic < std::max(1, lowestHarmonic)) {
+            break;
+        }
+        if (maxHarmonics.empty() || maxHarmonics.back() != maxHarmonic) {
+            maxHarmonics.push_back(maxHarmonic);
+        }
+    }
+    return maxHarmonics;
+}
+
+//==============================================================================
+// FNV-1a (32bit) に value の 4 バイトを混ぜる
+inline uint32_t hashWord(uint32_t hash, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        hash = (hash ^ ((value >> (i * 8)) & 0xff)) * 16777619u;
+    }
+    return hash;
+}
+const uint32_t HASH_SEED = 2166136261u;
+
+// 各段のスペクトルのハッシュ。テーブルを作らずに求まるので、キャッシュを読む前に今の定義の値と比べられる。
+// 係数は float に丸めてから混ぜるので、計算の最後の桁の違いでは変わりにくい
+template <typename SpectrumFunction>
+uint32_t hashSpectrum(SpectrumFunction &&spectrum, const std::vector<int32_t> &maxHarmonics) {
+    auto hash = HASH_SEED;
+    for (auto maxHarmonic : maxHarmonics) {
+        hash = hashWord(hash, (uint32_t)maxHarmonic);
+        for (int h = 1; h <= maxHarmonic; ++h) {
+            auto c = std::complex<double>(spectrum(h, maxHarmonic));
+            float parts[2]{(float)c.real(), (float)c.imag()};
+            uint32_t bits[2];
+            std::memcpy(bits, parts, sizeof(bits));
+            hash = hashWord(hash, bits[0]);
+            hash = hashWord(hash, bits[1]);
+        }
+    }
+    return hash;
+}
+
+// ヘッダの後ろ (各段の倍音数とテーブル) のハッシュ。壊れたり途中で切れたりしたキャッシュを見分ける
+inline uint32_t hashBody(const char *data, size_t size) {
+    auto hash = HASH_SEED;
+    for (size_t i = 0; i + 4 <= size; i += 4) {
+        uint32_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = hashWord(hash, word);
+    }
+    return hash;
+}
+
+}  // namespace wavetable
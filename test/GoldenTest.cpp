@@ -0,0 +1,342 @@
+#include <JuceHeader.h>
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "../src/Fft.h"
+#include "../src/Params.h"
+#include "../src/Voice.h"
+
+/*
+  決まった音色と MIDI シーケンスを BerryVoice / BerrySynthesiser で描画し、golden/ に保存してある結果と比べる。
+  最大誤差・RMS 誤差・スペクトル距離 (対数スペクトルの差の RMS) がそれぞれ許容値に収まっていれば通す。
+  - BERRY_UPDATE_GOLDEN=1 で実行すると比べずに golden/ を書き直す (意図して音を変えたとき)
+  - BERRY_GOLDEN_EXACT=1 で実行すると 1 ビットでも違えば失敗にする (出力が変わらないはずのリファクタリングのとき)
+*/
+
+namespace {
+const double SAMPLE_RATE = 48000.0;
+const int NUM_CHANNELS = 2;
+const uint32_t GOLDEN_MAGIC = 0x44475242;  // "BRGD"
+
+// 1 チャンネルずつ並べたもの
+using Render = std::vector<std::vector<float>>;
+
+//==============================================================================
+struct Tolerance {
+    double maxError;
+    double rmsError;
+    double spectralDistance;  // dB
+};
+// float と double (BERRY_DOUBLE_PRECISION) の違いやライブラリの誤差は通し、音が変わったら落とす程度
+const Tolerance DEFAULT_TOLERANCE{1e-3, 1e-4, 0.5};
+const Tolerance EXACT{0.0, 0.0, 0.0};
+
+bool isEnabled(const char *name) {
+    auto *value = std::getenv(name);
+    return value != nullptr && std::string(value) != "0";
+}
+
+std::string goldenPath(const std::string &name) { return std::string(BERRY_GOLDEN_DIR) + "/" + name + ".bin"; }
+
+bool readGolden(const std::string &name, Render &render) {
+    std::ifstream ifs(goldenPath(name), std::ios::in | std::ios::binary);
+    uint32_t header[3]{};
+    if (!ifs.read(reinterpret_cast<char *>(header), sizeof(header)) || header[0] != GOLDEN_MAGIC) {
+        return false;
+    }
+    render.assign(header[1], std::vector<float>(header[2]));
+    for (auto &channel : render) {
+        ifs.read(reinterpret_cast<char *>(channel.data()), channel.size() * sizeof(float));
+    }
+    return (bool)ifs;
+}
+
+void writeGolden(const std::string &name, const Render &render) {
+    std::ofstream ofs(goldenPath(name), std::ios::out | std::ios::binary);
+    uint32_t header[3]{GOLDEN_MAGIC, (uint32_t)render.size(), (uint32_t)render[0].size()};
+    ofs.write(reinterpret_cast<const char *>(header), sizeof(header));
+    for (auto &channel : render) {
+        ofs.write(reinterpret_cast<const char *>(channel.data()), channel.size() * sizeof(float));
+    }
+    ASSERT_TRUE((bool)ofs) << "failed to write " << goldenPath(name);
+}
+
+//==============================================================================
+double maxError(const std::vector<float> &actual, const std::vector<float> &expected) {
+    double error = 0.0;
+    for (size_t i = 0; i < expected.size(); ++i) {
+        error = std::max(error, (double)std::abs(actual[i] - expected[i]));
+    }
+    return error;
+}
+
+double rmsError(const std::vector<float> &actual, const std::vector<float> &expected) {
+    double sum = 0.0;
+    for (size_t i = 0; i < expected.size(); ++i) {
+        double d = actual[i] - expected[i];
+        sum += d * d;
+    }
+    return std::sqrt(sum / expected.size());
+}
+
+// ハン窓をかけたフレームごとの振幅スペクトル (dB) の差の RMS を、フレームについて平均したもの。
+// -100dB より小さい成分はその値に丸めるので、無音同士の違いは数えない
+double spectralDistance(const std::vector<float> &actual, const std::vector<float> &expected) {
+    const int frameSize = 1024;
+    const int hop = frameSize / 2;
+    const double floor = 1e-5;
+    std::vector<double> window(frameSize);
+    for (int i = 0; i < frameSize; ++i) {
+        window[i] = 0.5 - 0.5 * std::cos(math_constants::TWO_PI * i / frameSize);
+    }
+    auto spectrum = [&](const std::vector<float> &signal, int start, std::vector<double> &db) {
+        std::vector<std::complex<double>> data(frameSize);
+        for (int i = 0; i < frameSize; ++i) {
+            data[i] = signal[start + i] * window[i];
+        }
+        fft::transform(data, false);
+        for (int k = 0; k <= frameSize / 2; ++k) {
+            db[k] = 20 * std::log10(std::max(floor, std::abs(data[k]) * 2 / frameSize));
+        }
+    };
+    std::vector<double> a(frameSize / 2 + 1);
+    std::vector<double> b(frameSize / 2 + 1);
+    double total = 0.0;
+    int numFrames = 0;
+    for (int start = 0; start + frameSize <= (int)expected.size(); start += hop) {
+        spectrum(actual, start, a);
+        spectrum(expected, start, b);
+        double sum = 0.0;
+        for (size_t k = 0; k < a.size(); ++k) {
+            sum += (a[k] - b[k]) * (a[k] - b[k]);
+        }
+        total += std::sqrt(sum / a.size());
+        numFrames++;
+    }
+    return numFrames > 0 ? total / numFrames : 0.0;
+}
+
+void expectMatchesGolden(const std::string &name, const Render &actual, const Tolerance &tolerance) {
+    if (isEnabled("BERRY_UPDATE_GOLDEN")) {
+        writeGolden(name, actual);
+        return;
+    }
+    Render expected;
+    ASSERT_TRUE(readGolden(name, expected))
+        << "missing golden " << goldenPath(name) << " (run with BERRY_UPDATE_GOLDEN=1 to create it)";
+    ASSERT_EQ(expected.size(), actual.size());
+    auto &t = isEnabled("BERRY_GOLDEN_EXACT") ? EXACT : tolerance;
+    for (size_t ch = 0; ch < expected.size(); ++ch) {
+        ASSERT_EQ(expected[ch].size(), actual[ch].size());
+        EXPECT_LE(maxError(actual[ch], expected[ch]), t.maxError) << name << " ch" << ch;
+        EXPECT_LE(rmsError(actual[ch], expected[ch]), t.rmsError) << name << " ch" << ch;
+        EXPECT_LE(spectralDistance(actual[ch], expected[ch]), t.spectralDistance) << name << " ch" << ch;
+    }
+}
+
+//==============================================================================
+struct Patch {
+    int numHarmonics;  // 低い方から鳴らす倍音の数 (NUM_OSC なら最後のノコギリ波の高次倍音まで鳴らす)
+    int numNoises;
+    FILTER_TYPE filterType;
+    FILTER_FREQ_TYPE freqType;
+    bool delay;
+};
+
+// 鳴らさない倍音とノイズはミュートする。音色ごとの違いも描画に入るように、音色によって倍音のバランスを変える
+void applyPatch(AllParams &p, const Patch &patch) {
+    for (int t = 0; t < NUM_TIMBRES; ++t) {
+        auto &mainParams = p.mainParams[t];
+        for (int i = 0; i < NUM_OSC; ++i) {
+            *mainParams.oscParams[i].Gain = 1.0f / (1 + i * (t + 1) * 0.25f);
+            *mainParams.envelopeParams[i].Decay = 0.5f;
+        }
+        for (int i = 0; i < NUM_NOISE; ++i) {
+            *mainParams.noiseParams[i].Gain = 0.5f;
+        }
+    }
+    for (int i = patch.numHarmonics; i < NUM_OSC; ++i) {
+        p.soloMuteParams.turnOnMute(false, i);
+    }
+    for (int i = patch.numNoises; i < NUM_NOISE; ++i) {
+        p.soloMuteParams.turnOnMute(true, i);
+    }
+    for (auto &noiseUnitParams : p.noiseUnitParams) {
+        for (int i = 0; i < NUM_NOISE_FILTER; ++i) {
+            auto &fp = noiseUnitParams.filterParams[i];
+            *fp.Enabled = i == 0;
+            *fp.Type = static_cast<int>(patch.filterType);
+            *fp.FreqType = static_cast<int>(patch.freqType);
+            *fp.Semitone = 24;
+            *fp.Q = 4.0f;
+            *fp.Gain = 12.0f;
+        }
+    }
+    *p.delayParams.Enabled = patch.delay;
+    *p.delayParams.Type = static_cast<int>(DELAY_TYPE::PingPong);
+    *p.delayParams.TimeL = 0.03f;
+    *p.delayParams.TimeR = 0.05f;
+    p.freeze();
+}
+
+// 1 つのボイスで noteNumber を鳴らし、blockSize ずつ renderBlock する
+Render renderVoice(const Patch &patch, int noteNumber, int numSamples, int blockSize) {
+    AllParams p{};
+    applyPatch(p, patch);
+    juce::AudioBuffer<float> buffer{NUM_CHANNELS, blockSize};
+    BerryVoice voice{buffer, p};
+    voice.setNoiseSeed(1);
+    voice.setCurrentPlaybackSampleRate(SAMPLE_RATE);
+    BerrySound sound;
+    voice.startNote(noteNumber, 0.8f, &sound, 8192);
+    auto calculatedParams = CalculatedParams{};
+    auto calculatedNoiseParams = CalculatedParams{};
+    p.calculateIntermediateParams(calculatedParams, calculatedNoiseParams, noteNumber);
+    voice.applyParamsBeforeLoop(SAMPLE_RATE, calculatedParams, calculatedNoiseParams);
+
+    Render render(NUM_CHANNELS, std::vector<float>(numSamples));
+    for (int position = 0; position < numSamples; position += blockSize) {
+        auto length = std::min(blockSize, numSamples - position);
+        buffer.clear();
+        voice.renderBlock(buffer, 0, length, SAMPLE_RATE, NUM_CHANNELS, calculatedParams, calculatedNoiseParams);
+        for (int ch = 0; ch < NUM_CHANNELS; ++ch) {
+            std::copy_n(buffer.getReadPointer(ch), length, render[ch].data() + position);
+        }
+    }
+    return render;
+}
+
+// 描画する前にブロックの番号を渡されて、そのブロックの MIDI イベントを足す
+using Sequence = std::function<void(int block, juce::MidiBuffer &midi)>;
+
+// BerrySynthesiser で sequence を鳴らす。ボイスの数とノイズのシードはプラグインと同じにする
+Render renderSynth(const Patch &patch, const Sequence &sequence, int numBlocks, int blockSize) {
+    AllParams p{};
+    applyPatch(p, patch);
+    juce::AudioBuffer<float> buffer{NUM_CHANNELS, 0};
+    MonoStack monoStack;
+    BerrySynthesiser synth(monoStack, buffer, p);
+    for (int i = 0; i < MAX_VOICES; ++i) {
+        auto *voice = new BerryVoice(buffer, p);
+        voice->setNoiseSeed(i);
+        synth.addVoice(voice);
+    }
+    synth.setCurrentPlaybackSampleRate(SAMPLE_RATE);
+    synth.prepareParallelRendering(0, blockSize);
+
+    Render render(NUM_CHANNELS, std::vector<float>(numBlocks * blockSize));
+    juce::AudioBuffer<float> out{NUM_CHANNELS, blockSize};
+    for (int block = 0; block < numBlocks; ++block) {
+        juce::MidiBuffer midi;
+        sequence(block, midi);
+        out.clear();
+        synth.renderNextBlock(out, midi, 0, blockSize);
+        for (int ch = 0; ch < NUM_CHANNELS; ++ch) {
+            std::copy_n(out.getReadPointer(ch), blockSize, render[ch].data() + block * blockSize);
+        }
+    }
+    return render;
+}
+
+// 和音を鳴らし、途中でピッチベンドしてから離す (ブロックの途中のイベントも入れる)
+void chordSequence(int block, juce::MidiBuffer &midi) {
+    if (block == 0) {
+        midi.addEvent(juce::MidiMessage::noteOn(1, 48, 0.9f), 0);
+        midi.addEvent(juce::MidiMessage::noteOn(1, 55, 0.7f), 0);
+        midi.addEvent(juce::MidiMessage::noteOn(1, 64, 0.5f), 64);
+    }
+    if (block == 20) {
+        midi.addEvent(juce::MidiMessage::pitchWheel(1, 12288), 0);
+    }
+    if (block == 40) {
+        midi.addEvent(juce::MidiMessage::noteOff(1, 48), 0);
+        midi.addEvent(juce::MidiMessage::noteOff(1, 55), 0);
+        midi.addEvent(juce::MidiMessage::noteOff(1, 64), 128);
+    }
+}
+}  // namespace
+
+//==============================================================================
+TEST(GoldenVoice, SingleSine) {
+    auto render = renderVoice({1, 0, FILTER_TYPE::Lowpass, FILTER_FREQ_TYPE::Absolute, false}, 69, 9600, 128);
+    expectMatchesGolden("voice_single_sine", render, DEFAULT_TOLERANCE);
+}
+
+TEST(GoldenVoice, AllHarmonics) {
+    auto render = renderVoice({NUM_OSC, 0, FILTER_TYPE::Lowpass, FILTER_FREQ_TYPE::Absolute, false}, 48, 9600, 128);
+    expectMatchesGolden("voice_all_harmonics", render, DEFAULT_TOLERANCE);
+}
+
+TEST(GoldenVoice, NoiseAbsFilter) {
+    auto render = renderVoice({0, NUM_NOISE, FILTER_TYPE::Bandpass1, FILTER_FREQ_TYPE::Absolute, false}, 60, 9600, 128);
+    expectMatchesGolden("voice_noise_abs_filter", render, DEFAULT_TOLERANCE);
+}
+
+TEST(GoldenVoice, NoiseRelFilter) {
+    auto render = renderVoice({0, NUM_NOISE, FILTER_TYPE::Peaking, FILTER_FREQ_TYPE::Relative, false}, 60, 9600, 128);
+    expectMatchesGolden("voice_noise_rel_filter", render, DEFAULT_TOLERANCE);
+}
+
+TEST(GoldenSynth, Chord) {
+    Patch patch{NUM_OSC, NUM_NOISE, FILTER_TYPE::Lowpass, FILTER_FREQ_TYPE::Relative, false};
+    auto render = renderSynth(patch, chordSequence, 60, 256);
+    expectMatchesGolden("synth_chord", render, DEFAULT_TOLERANCE);
+}
+
+TEST(GoldenSynth, ChordWithDelay) {
+    Patch patch{NUM_OSC, NUM_NOISE, FILTER_TYPE::Lowpass, FILTER_FREQ_TYPE::Relative, true};
+    auto render = renderSynth(patch, chordSequence, 60, 256);
+    expectMatchesGolden("synth_chord_delay", render, DEFAULT_TOLERANCE);
+}
+
+// ブロックの大きさを変えても同じ音になる (MIDI イベントはブロックの区切りに合わせておく)
+TEST(GoldenSynth, BlockSizeDoesNotChangeOutput) {
+    Patch patch{NUM_OSC, NUM_NOISE, FILTER_TYPE::Lowpass, FILTER_FREQ_TYPE::Relative, true};
+    auto sequence = [](int blockSize) {
+        return [blockSize](int block, juce::MidiBuffer &midi) {
+            auto position = block * blockSize;
+            if (position == 0) {
+                midi.addEvent(juce::MidiMessage::noteOn(1, 60, 0.8f), 0);
+            }
+            if (position == 7680) {
+                midi.addEvent(juce::MidiMessage::noteOff(1, 60), 0);
+            }
+        };
+    };
+    auto large = renderSynth(patch, sequence(512), 30, 512);
+    auto small = renderSynth(patch, sequence(64), 240, 64);
+    for (int ch = 0; ch < NUM_CHANNELS; ++ch) {
+        EXPECT_LE(maxError(small[ch], large[ch]), DEFAULT_TOLERANCE.maxError) << "ch" << ch;
+    }
+}
+
+//==============================================================================
+// キャッシュに書いたテーブルは、同じ波形として読む時だけ、壊れていなければそのまま読める
+TEST(WavetableCache, RejectsOtherWaveformsAndCorruptData) {
+    auto sawHigh = wavetable::getWaveform(wavetable::WAVEFORM_ID::SawHigh);
+    WavetableBank bank;
+    bank.build(sawHigh, wavetable::DEFAULT_LEVELS_PER_OCTAVE);
+    std::vector<float> storage(bank.getSerializedSize() / sizeof(float));
+    auto *data = reinterpret_cast<char *>(storage.data());
+    bank.serialize(data);
+    auto size = bank.getSerializedSize();
+
+    WavetableBank loaded;
+    ASSERT_EQ(loaded.attach(data, size, sawHigh, wavetable::DEFAULT_LEVELS_PER_OCTAVE), size);
+    ASSERT_EQ(loaded.getNumLevels(), bank.getNumLevels());
+    for (int k = 0; k < bank.getNumLevels(); ++k) {
+        EXPECT_EQ(std::memcmp(loaded.getTable(k), bank.getTable(k), sizeof(float) * (WAVETABLE_SIZE + 1)), 0);
+    }
+
+    auto saw = wavetable::getWaveform(wavetable::WAVEFORM_ID::Saw);
+    EXPECT_EQ(loaded.attach(data, size, saw, wavetable::DEFAULT_LEVELS_PER_OCTAVE), 0u);
+    EXPECT_EQ(loaded.attach(data, size - sizeof(float), sawHigh, wavetable::DEFAULT_LEVELS_PER_OCTAVE), 0u);
+    storage.back() += 1.0f;
+    EXPECT_EQ(loaded.attach(data, size, sawHigh, wavetable::DEFAULT_LEVELS_PER_OCTAVE), 0u);
+}